@@ -299,6 +299,41 @@ def run_reading_tfrecords_ablation_benchmark():
                              output_file='test_utils/benchmark_reading_tfrecords_ablation.png')
 
 
+def run_inflate_backend_benchmark():
+    ##################################################################
+    # Benchmarking decoders of compressed tfrecords
+    ##################################################################
+    filenames = ['test_utils/test-small-gzip-r00.tfrecords',
+                 'test_utils/test-small-gzip-r01.tfrecords',
+                 'test_utils/test-small-gzip-r02.tfrecords',
+                 'test_utils/test-small-gzip-r03.tfrecords']
+
+    def read_records(inflate_backend):
+        for i in range(20):
+            for filename in filenames:
+                rr = db.RecordReader(filename, db.Compression.ZLIB, inflate_backend=inflate_backend)
+                records = list(rr)
+
+    results = []
+
+    @benchmark.timeit
+    def reading_with_zlib():
+        read_records(db.InflateBackend.ZLIB)
+
+    results.append((reading_with_zlib(), "Reading compressed records\nInflateBackend.ZLIB"))
+
+    @benchmark.timeit
+    def reading_with_libdeflate():
+        read_records(db.InflateBackend.LIBDEFLATE)
+
+    results.append((reading_with_libdeflate(), "Reading compressed records\nInflateBackend.LIBDEFLATE"))
+
+    benchmark.do_simple_plot(results,
+                             figsize=(8, 6),
+                             title='Reading compressed tfrecords, each of four files is read 20 times',
+                             output_file='test_utils/benchmark_inflate_backend.png')
+
+
 def run_reading_tfrecords_comparison_to_tensorflow_benchmark():
     ##################################################################
     # Benchmarking reading tfrecords
@@ -392,4 +427,6 @@ time.sleep(1.0)
 # time.sleep(1.0)
 run_reading_tfrecords_ablation_benchmark()
 time.sleep(1.0)
+run_inflate_backend_benchmark()
+time.sleep(1.0)
 run_reading_tfrecords_comparison_to_tensorflow_benchmark()
@@ -205,6 +205,11 @@ zlib = list(glob.glob('libs/zlib/*.c'))
 lz4 = list(glob.glob('libs/lz4/lib/*.c'))
 dareblopy = list(glob.glob('sources/*.c*')) + list(glob.glob('sources/protobuf/*.c*'))
 
+libdeflate = """deflate_decompress.c gzip_decompress.c zlib_decompress.c adler32.c crc32.c utils.c
+        x86/cpu_features.c arm/cpu_features.c"""
+
+libdeflate = ['libs/libdeflate/lib/' + x for x in libdeflate.split()]
+
 crc32c = """crc32c.cc crc32c_arm64.cc crc32c_portable.cc crc32c_sse42.cc"""
 
 crc32c = ['libs/crc32c/src/' + x for x in crc32c.split()]
@@ -333,7 +338,7 @@ extra_compile_asm_args = {
 }
 
 extension = Extension("_dareblopy",
-                      jpeg_turbo + jpeg_vanila + jpeg_turbo_simd + dareblopy + fsal + crc32c + zlib + protobuf + lz4,
+                      jpeg_turbo + jpeg_vanila + jpeg_turbo_simd + dareblopy + fsal + crc32c + zlib + libdeflate + protobuf + lz4,
                              define_macros = definitions[target_os],
                              include_dirs=[
                                  "libs/zlib",
@@ -341,6 +346,7 @@ extension = Extension("_dareblopy",
                                  "libs/lz4/lib",
                                  "libs/pybind11/include",
                                  "libs/crc32c/include",
+                                 "libs/libdeflate",
                                  "libs/protobuf/src",
                                  "sources",
                                  "configs"
@@ -0,0 +1,240 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include "fsal_common.h"
+#include "FileInterface.h"
+
+#include <string.h>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "common.h"
+#include "io_engine.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+
+namespace fsal
+{
+	// Read-only file that keeps `depth` blocks of `block_size` bytes in flight ahead of the read position.
+	// Reads are issued through IOEngine, which can be shared between several files.
+	// Sequential reading never waits on I/O as long as the consumer is slower than the storage.
+	class AsyncReadFile : public FileInterface
+	{
+		struct Block
+		{
+			std::unique_ptr<uint8_t[]> data;
+			IORequest request;
+		};
+
+	public:
+		AsyncReadFile(const path& filepath, std::shared_ptr<IOEngine> engine, size_t block_size, int depth):
+			m_path(filepath), m_engine(std::move(engine)), m_block_size(block_size), m_depth(std::max(depth, 1))
+		{
+#ifdef _WIN32
+			throw runtime_error("Asynchronous reading is not supported on this platform");
+#else
+			m_fd = open(filepath.string().c_str(), O_RDONLY);
+			if (m_fd < 0)
+				throw runtime_error("Can't open file: %s", filepath.string().c_str());
+
+			struct stat st;
+			fstat(m_fd, &st);
+			m_size = st.st_size;
+			m_last_write_time = st.st_mtime;
+#endif
+		}
+
+		~AsyncReadFile()
+		{
+#ifndef _WIN32
+			Drain();
+			close(m_fd);
+#endif
+		}
+
+		// Starts reading ahead from the current position without waiting for a read call.
+		void Prefetch()
+		{
+			if (m_window.empty())
+			{
+				m_next_submit = m_position - m_position % m_block_size;
+			}
+			while (int(m_window.size()) < m_depth && m_next_submit < m_size)
+			{
+				std::unique_ptr<Block> block;
+				if (m_free.empty())
+				{
+					block.reset(new Block);
+					block->data.reset(new uint8_t[m_block_size]);
+				}
+				else
+				{
+					block = std::move(m_free.back());
+					m_free.pop_back();
+				}
+				block->request.fd = m_fd;
+				block->request.offset = m_next_submit;
+				block->request.dst = block->data.get();
+				block->request.size = std::min(m_block_size, size_t(m_size - m_next_submit));
+				block->request.result = 0;
+				m_engine->Submit(&block->request);
+				m_next_submit += block->request.size;
+				m_window.push_back(std::move(block));
+			}
+		}
+
+		// True if reads up to the end of file were already issued
+		bool PrefetchExhausted() const { return m_next_submit >= m_size; }
+
+		int fd() const { return m_fd; }
+
+		bool ok() const { return m_fd >= 0; }
+
+		path GetPath() const { return m_path; }
+
+		Status Open(path filepath, Mode mode) { return Status::kFailed; }
+
+		Status ReadData(uint8_t* dst, size_t size, size_t* bytesRead)
+		{
+			*bytesRead = 0;
+			while (size > 0)
+			{
+				if (m_position >= m_size)
+					return Status::kEOF;
+
+				Block* block = Front();
+				size_t offset_in_block = m_position - block->request.offset;
+				size_t will_copy = std::min(block->request.size - offset_in_block, size);
+				if (dst != nullptr)
+				{
+					memcpy(dst, block->data.get() + offset_in_block, will_copy);
+					dst += will_copy;
+				}
+				size -= will_copy;
+				*bytesRead += will_copy;
+				m_position += will_copy;
+			}
+			return Status::kOk;
+		}
+
+		Status WriteData(const uint8_t* src, size_t size) { return Status::kFailed; }
+
+		Status SetPosition(size_t position) const override
+		{
+			if (position > m_size)
+				return Status::kFailed;
+			// Window is adjusted lazily on the next read
+			m_position = position;
+			return Status::kOk;
+		}
+
+		size_t GetPosition() const override { return m_position; }
+
+		size_t GetSize() const override { return m_size; }
+
+		Status FlushBuffer() const override { return Status::kFailed; }
+
+		uint64_t GetLastWriteTime() const override { return m_last_write_time; }
+
+		const uint8_t* GetDataPointer() const override { return nullptr; }
+
+		uint8_t* GetDataPointer()  override { return nullptr; }
+
+		bool Resize(size_t newSize) { return false; }
+
+	private:
+		// Returns completed block that contains current position, moving the window if needed
+		Block* Front()
+		{
+			while (!m_window.empty())
+			{
+				Block& block = *m_window.front();
+				uint64_t begin = block.request.offset;
+				uint64_t end = begin + block.request.size;
+				if (m_position >= begin && m_position < end)
+					break;
+
+				if (m_position >= end && m_position < m_next_submit)
+				{
+					// Block was consumed, or skipped over by seeking forward
+					Recycle();
+					Prefetch();
+				}
+				else
+				{
+					// Random access outside of the window
+					Drain();
+				}
+			}
+			Prefetch();
+
+			Block* block = m_window.front().get();
+			m_engine->WaitFor(&block->request);
+			if (block->request.result < 0)
+			{
+				throw runtime_error("Read failed: %s. File: %s", strerror(int(-block->request.result)), m_path.string().c_str());
+			}
+			if (size_t(block->request.result) < block->request.size)
+			{
+				// Short read, finish it synchronously
+				size_t done = block->request.result;
+#ifndef _WIN32
+				while (done < block->request.size)
+				{
+					ssize_t r = pread(m_fd, block->data.get() + done, block->request.size - done, block->request.offset + done);
+					if (r <= 0)
+						throw runtime_error("Unexpected end of file. File: %s", m_path.string().c_str());
+					done += r;
+				}
+#endif
+				block->request.result = done;
+			}
+			return block;
+		}
+
+		void Recycle()
+		{
+			m_engine->WaitFor(&m_window.front()->request);
+			m_free.push_back(std::move(m_window.front()));
+			m_window.pop_front();
+		}
+
+		void Drain()
+		{
+			while (!m_window.empty())
+			{
+				Recycle();
+			}
+		}
+
+		path m_path;
+		std::shared_ptr<IOEngine> m_engine;
+		size_t m_block_size;
+		int m_depth;
+		int m_fd = -1;
+		size_t m_size = 0;
+		uint64_t m_last_write_time = 0;
+		mutable size_t m_position = 0;
+		uint64_t m_next_submit = 0;
+		std::deque<std::unique_ptr<Block> > m_window;
+		std::vector<std::unique_ptr<Block> > m_free;
+	};
+}
@@ -311,10 +311,10 @@ void Records::RecordParser::ParseSingleExampleInplace(const std::string& seriali
 	}
 }
 
-void Records::RecordParser::ParseSingleExampleImpl(const std::string& serialized, std::vector<void*>& output, int batch_index)
+void Records::RecordParser::ParseSingleExampleImpl(ExampleView serialized, std::vector<void*>& output, int batch_index)
 {
 	Example example;
-	example.ParseFromString(serialized);
+	example.ParseFromArray(serialized.data, int(serialized.size));
 
 	const Features& features = example.features();
 	const auto& feature_dict = features.feature();
@@ -363,6 +363,16 @@ void Records::RecordParser::ParseSingleExampleImpl(const std::string& serialized
 }
 
 py::list Records::RecordParser::ParseExample(const std::vector<std::string>& serialized)
+{
+	std::vector<ExampleView> views(serialized.size());
+	for (size_t i = 0; i < serialized.size(); ++i)
+	{
+		views[i] = { (const uint8_t*)serialized[i].data(), serialized[i].size() };
+	}
+	return ParseExampleViews(views);
+}
+
+py::list Records::RecordParser::ParseExampleViews(const std::vector<ExampleView>& serialized)
 {
 	py::list tensors;
 	std::vector<void*> tensor_ptrs;
@@ -410,6 +420,11 @@ py::list Records::RecordParser::ParseExample(const std::vector<std::string>& ser
 }
 
 py::list Records::RecordParser::ParseSingleExample(const std::string& serialized)
+{
+	return ParseSingleExampleView({ (const uint8_t*)serialized.data(), serialized.size() });
+}
+
+py::list Records::RecordParser::ParseSingleExampleView(ExampleView serialized)
 {
 	py::list  tensors;
 	std::vector<void*> tensor_ptrs;
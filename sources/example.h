@@ -31,6 +31,13 @@ namespace Records
 
 	typedef std::vector<size_t> TensorShape;
 
+	// Serialized example that is not owned by the parser, e.g. a record in a shuffle buffer
+	struct ExampleView
+	{
+		const uint8_t* data;
+		size_t size;
+	};
+
 	class HIDDEN RecordParser
 	{
 	public:
@@ -59,8 +66,12 @@ namespace Records
 		py::list ParseExample(const std::vector<std::string>& serialized);
 
 		py::list ParseSingleExample(const std::string& serialized);
+
+		py::list ParseExampleViews(const std::vector<ExampleView>& serialized);
+
+		py::list ParseSingleExampleView(ExampleView serialized);
 	private:
-		void ParseSingleExampleImpl(const std::string& serialized, std::vector<void*>& output, int batch_index);
+		void ParseSingleExampleImpl(ExampleView serialized, std::vector<void*>& output, int batch_index);
 
 		std::vector<FixedLenFeature> fixed_len_features;
 		bool m_run_parallel;
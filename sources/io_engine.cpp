@@ -0,0 +1,337 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "io_engine.h"
+#include "common.h"
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#ifdef __NR_io_uring_setup
+#define HAS_IO_URING
+#endif
+#endif
+#endif
+
+
+#ifndef _WIN32
+class ThreadPoolIOEngine: public IOEngine
+{
+public:
+	explicit ThreadPoolIOEngine(int thread_count)
+	{
+		for (int i = 0; i < thread_count; ++i)
+		{
+			m_threads.emplace_back([this]() { Worker(); });
+		}
+	}
+
+	~ThreadPoolIOEngine()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_submit_cv.notify_all();
+		for (auto& t: m_threads)
+		{
+			t.join();
+		}
+	}
+
+	void Submit(IORequest* request) override
+	{
+		request->in_flight = true;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_submitted.push_back(request);
+		}
+		m_submit_cv.notify_one();
+	}
+
+	const char* name() const override { return "threadpool"; }
+
+protected:
+	void Reap() override
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_complete_cv.wait(lock, [this]() { return !m_completed.empty(); });
+		for (auto* request: m_completed)
+		{
+			request->in_flight = false;
+		}
+		m_completed.clear();
+	}
+
+private:
+	void Worker()
+	{
+		while (true)
+		{
+			IORequest* request = nullptr;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_submit_cv.wait(lock, [this]() { return m_stop || !m_submitted.empty(); });
+				if (m_stop)
+					return;
+				request = m_submitted.front();
+				m_submitted.pop_front();
+			}
+
+			ssize_t result = pread(request->fd, request->dst, request->size, request->offset);
+			request->result = result < 0 ? -errno : result;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_completed.push_back(request);
+			}
+			m_complete_cv.notify_one();
+		}
+	}
+
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_submit_cv;
+	std::condition_variable m_complete_cv;
+	std::deque<IORequest*> m_submitted;
+	std::vector<IORequest*> m_completed;
+	bool m_stop = false;
+};
+#endif
+
+
+#ifdef HAS_IO_URING
+// io_uring through raw system calls, so that there is no dependency on liburing.
+class UringIOEngine: public IOEngine
+{
+public:
+	// Returns nullptr if io_uring is not available
+	static UringIOEngine* Create(int queue_depth)
+	{
+		std::unique_ptr<UringIOEngine> engine(new UringIOEngine);
+		if (!engine->Init(queue_depth))
+			return nullptr;
+		return engine.release();
+	}
+
+	~UringIOEngine()
+	{
+		// Requests still in flight write to buffers of their owners, owners are expected to wait for them.
+		if (m_sqes)
+			munmap(m_sqes, m_sqes_size);
+		if (m_cq_ptr && m_cq_ptr != m_sq_ptr)
+			munmap(m_cq_ptr, m_cq_size);
+		if (m_sq_ptr)
+			munmap(m_sq_ptr, m_sq_size);
+		if (m_ring_fd >= 0)
+			close(m_ring_fd);
+	}
+
+	void Submit(IORequest* request) override
+	{
+		while (m_in_flight >= m_cq_entries || m_in_flight >= m_sq_entries)
+		{
+			Reap();
+		}
+
+		unsigned tail = *m_sq_tail;
+		unsigned index = tail & *m_sq_mask;
+		io_uring_sqe* sqe = &m_sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+
+		// READV instead of READ to support older kernels. iovec is consumed at submission time (SUBMIT_STABLE)
+		m_iovecs[index].iov_base = request->dst;
+		m_iovecs[index].iov_len = request->size;
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = request->fd;
+		sqe->off = request->offset;
+		sqe->addr = (uint64_t)&m_iovecs[index];
+		sqe->len = 1;
+		sqe->user_data = (uint64_t)request;
+
+		m_sq_array[index] = index;
+		__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+		request->in_flight = true;
+		++m_in_flight;
+
+		while ((int)syscall(__NR_io_uring_enter, m_ring_fd, 1, 0, 0, nullptr, 0) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EBUSY)
+				throw runtime_error("io_uring submission failed: %s", strerror(errno));
+
+			// Kernel is short of resources or the completion queue is full. Retrying at once would spin, so wait
+			// for one of the earlier requests to complete, or back off if this is the only one
+			if (ReapAvailable() == 0)
+			{
+				if (m_in_flight > 1)
+					Reap();
+				else
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		}
+	}
+
+	const char* name() const override { return "io_uring"; }
+
+protected:
+	void Reap() override
+	{
+		while (ReapAvailable() == 0)
+		{
+			int ret = (int)syscall(__NR_io_uring_enter, m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (ret < 0 && errno != EINTR)
+				throw runtime_error("io_uring wait failed: %s", strerror(errno));
+		}
+	}
+
+private:
+	UringIOEngine() = default;
+
+	int ReapAvailable()
+	{
+		int count = 0;
+		unsigned head = *m_cq_head;
+		while (head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+		{
+			io_uring_cqe* cqe = &m_cqes[head & *m_cq_mask];
+			auto* request = (IORequest*)cqe->user_data;
+			request->result = cqe->res;
+			request->in_flight = false;
+			--m_in_flight;
+			++head;
+			++count;
+		}
+		__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+		return count;
+	}
+
+	bool Init(int queue_depth)
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+
+		unsigned entries = 1;
+		while (entries < (unsigned)std::max(queue_depth, 1))
+			entries *= 2;
+
+		m_ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+		if (m_ring_fd < 0)
+			return false;
+
+		if (!(params.features & IORING_FEAT_SUBMIT_STABLE))
+			return false;
+
+		m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+		bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single_mmap)
+			m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+
+		void* sq_ptr = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+		if (sq_ptr == MAP_FAILED)
+			return false;
+		m_sq_ptr = (uint8_t*)sq_ptr;
+
+		if (single_mmap)
+		{
+			m_cq_ptr = m_sq_ptr;
+		}
+		else
+		{
+			void* cq_ptr = mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+			if (cq_ptr == MAP_FAILED)
+				return false;
+			m_cq_ptr = (uint8_t*)cq_ptr;
+		}
+
+		m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			return false;
+		m_sqes = (io_uring_sqe*)sqes;
+
+		m_sq_tail = (unsigned*)(m_sq_ptr + params.sq_off.tail);
+		m_sq_mask = (unsigned*)(m_sq_ptr + params.sq_off.ring_mask);
+		m_sq_array = (unsigned*)(m_sq_ptr + params.sq_off.array);
+		m_cq_head = (unsigned*)(m_cq_ptr + params.cq_off.head);
+		m_cq_tail = (unsigned*)(m_cq_ptr + params.cq_off.tail);
+		m_cq_mask = (unsigned*)(m_cq_ptr + params.cq_off.ring_mask);
+		m_cqes = (io_uring_cqe*)(m_cq_ptr + params.cq_off.cqes);
+
+		m_sq_entries = params.sq_entries;
+		m_cq_entries = params.cq_entries;
+		m_iovecs.resize(m_sq_entries);
+		return true;
+	}
+
+	int m_ring_fd = -1;
+	uint8_t* m_sq_ptr = nullptr;
+	uint8_t* m_cq_ptr = nullptr;
+	size_t m_sq_size = 0;
+	size_t m_cq_size = 0;
+	io_uring_sqe* m_sqes = nullptr;
+	size_t m_sqes_size = 0;
+
+	unsigned* m_sq_tail = nullptr;
+	unsigned* m_sq_mask = nullptr;
+	unsigned* m_sq_array = nullptr;
+	unsigned* m_cq_head = nullptr;
+	unsigned* m_cq_tail = nullptr;
+	unsigned* m_cq_mask = nullptr;
+	io_uring_cqe* m_cqes = nullptr;
+
+	unsigned m_sq_entries = 0;
+	unsigned m_cq_entries = 0;
+	unsigned m_in_flight = 0;
+	std::vector<iovec> m_iovecs;
+};
+#endif
+
+
+std::shared_ptr<IOEngine> IOEngine::Create(int queue_depth, bool allow_io_uring)
+{
+#ifdef _WIN32
+	throw runtime_error("Asynchronous reading is not supported on this platform");
+#else
+#ifdef HAS_IO_URING
+	if (allow_io_uring)
+	{
+		UringIOEngine* engine = UringIOEngine::Create(queue_depth);
+		if (engine)
+			return std::shared_ptr<IOEngine>(engine);
+	}
+#endif
+	return std::make_shared<ThreadPoolIOEngine>(std::min(std::max(queue_depth, 1), 16));
+#endif
+}
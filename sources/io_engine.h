@@ -0,0 +1,63 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+#include <memory>
+
+
+// Positional read of `size` bytes at `offset` of the file descriptor `fd` to `dst`.
+// `result` is the number of bytes read, or negated errno.
+struct IORequest
+{
+	int fd = -1;
+	uint64_t offset = 0;
+	uint8_t* dst = nullptr;
+	size_t size = 0;
+	int64_t result = 0;
+	bool in_flight = false;
+};
+
+
+// Engine that keeps many reads in flight. Uses io_uring when the kernel supports it, otherwise falls back to
+// a pool of threads doing pread.
+// Engine can be shared by several files, but requests must be submitted and waited on from one thread.
+class IOEngine
+{
+public:
+	virtual ~IOEngine() = default;
+
+	// Queues a read. `request` must stay alive and untouched until it is completed.
+	virtual void Submit(IORequest* request) = 0;
+
+	// Blocks until `request` completes. Other requests that complete meanwhile are marked as completed as well.
+	void WaitFor(IORequest* request)
+	{
+		while (request->in_flight)
+		{
+			Reap();
+		}
+	}
+
+	virtual const char* name() const = 0;
+
+	// Returns io_uring engine if available, otherwise a pread thread pool. `queue_depth` is the expected
+	// number of requests in flight.
+	static std::shared_ptr<IOEngine> Create(int queue_depth, bool allow_io_uring = true);
+
+protected:
+	// Blocks until at least one request completes and marks completed requests.
+	virtual void Reap() = 0;
+};
@@ -0,0 +1,179 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include "fsal_common.h"
+#include "FileInterface.h"
+
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include "libdeflate.h"
+#include "common.h"
+
+
+namespace fsal
+{
+	// Alternative to ZlibFile, that decompresses the whole file with libdeflate on the first access and serves reads
+	// from memory. libdeflate can only decode whole buffers, but it is several times faster than streaming inflate
+	// of zlib. The price is that the whole decompressed file is held in memory, on the other hand seeking is free.
+	// Multi-member gzip files and concatenated zlib streams are supported.
+	class LibdeflateFile : public FileInterface
+	{
+	public:
+		enum Format
+		{
+			Gzip,
+			Zlib
+		};
+
+		LibdeflateFile(const std::shared_ptr<FileInterface>& compressed, Format format): m_file(compressed), m_format(format)
+		{
+		}
+
+		bool ok() const { return m_file != nullptr; }
+
+		path GetPath() const { return m_file->GetPath(); }
+
+		Status Open(path filepath, Mode mode) { return Status::kFailed; }
+
+		Status ReadData(uint8_t* dst, size_t size, size_t* bytesRead)
+		{
+			Decompress();
+			size_t will_copy = std::min(size, m_size - std::min(m_position, m_size));
+			if (dst != nullptr)
+				memcpy(dst, m_data.get() + m_position, will_copy);
+			m_position += will_copy;
+			*bytesRead = will_copy;
+			return will_copy == size ? Status::kOk : Status::kEOF;
+		}
+
+		Status WriteData(const uint8_t* src, size_t size) { return Status::kFailed; }
+
+		Status SetPosition(size_t position) const override
+		{
+			const_cast<LibdeflateFile*>(this)->Decompress();
+			if (position > m_size)
+				return Status::kFailed;
+			m_position = position;
+			return Status::kOk;
+		}
+
+		size_t GetPosition() const override { return m_position; }
+
+		size_t GetSize() const override
+		{
+			const_cast<LibdeflateFile*>(this)->Decompress();
+			return m_size;
+		}
+
+		Status FlushBuffer() const override { return Status::kFailed; }
+
+		uint64_t GetLastWriteTime() const override { return 0; }
+
+		const uint8_t* GetDataPointer() const override
+		{
+			const_cast<LibdeflateFile*>(this)->Decompress();
+			return m_data.get();
+		}
+
+		uint8_t* GetDataPointer()  override
+		{
+			Decompress();
+			return m_data.get();
+		}
+
+		bool Resize(size_t newSize) { return false; }
+
+	private:
+		void Decompress()
+		{
+			if (m_decompressed)
+				return;
+
+			// Compressed data is used in place if the file is already in memory
+			const uint8_t* src = static_cast<const FileInterface*>(m_file.get())->GetDataPointer();
+			size_t src_size = m_file->GetSize();
+			std::unique_ptr<uint8_t[]> src_buffer;
+			if (src == nullptr)
+			{
+				src_buffer.reset(new uint8_t[src_size]);
+				m_file->SetPosition(0);
+				m_file->ReadData(src_buffer.get(), src_size, &src_size);
+				src = src_buffer.get();
+			}
+
+			std::unique_ptr<libdeflate_decompressor, void(*)(libdeflate_decompressor*)> decompressor(
+					libdeflate_alloc_decompressor(), libdeflate_free_decompressor);
+			if (!decompressor)
+				throw runtime_error("Failed to init libdeflate");
+
+			// For a single-member gzip file, size of the decompressed data is stored in the last four bytes (modulo
+			// 2^32). Otherwise it is guessed and the buffer grows as needed.
+			size_t capacity = src_size * 4;
+			if (m_format == Gzip && src_size >= 4)
+			{
+				const uint8_t* isize = src + src_size - 4;
+				size_t size = isize[0] | (isize[1] << 8u) | (isize[2] << 16u) | (size_t(isize[3]) << 24u);
+				if (size >= src_size / 2)
+					capacity = size;
+			}
+			capacity = std::max(capacity, size_t(MinCapacity));
+			m_data.reset(new uint8_t[capacity]);
+
+			size_t in_offset = 0;
+			size_t out_offset = 0;
+			while (in_offset < src_size)
+			{
+				size_t in_used = 0;
+				size_t out_used = 0;
+				libdeflate_result result = m_format == Gzip ?
+						libdeflate_gzip_decompress_ex(decompressor.get(), src + in_offset, src_size - in_offset,
+						                              m_data.get() + out_offset, capacity - out_offset, &in_used, &out_used) :
+						libdeflate_zlib_decompress_ex(decompressor.get(), src + in_offset, src_size - in_offset,
+						                              m_data.get() + out_offset, capacity - out_offset, &in_used, &out_used);
+
+				if (result == LIBDEFLATE_INSUFFICIENT_SPACE)
+				{
+					// The member is decoded again into a larger buffer
+					capacity *= 2;
+					uint8_t* data = new uint8_t[capacity];
+					memcpy(data, m_data.get(), out_offset);
+					m_data.reset(data);
+					continue;
+				}
+				if (result != LIBDEFLATE_SUCCESS)
+					throw runtime_error("Inflate failed: corrupted data. File: %s", GetPath().string().c_str());
+
+				in_offset += in_used;
+				out_offset += out_used;
+			}
+			m_size = out_offset;
+			m_decompressed = true;
+		}
+
+		enum
+		{
+			MinCapacity = 64 * 1024
+		};
+
+		std::shared_ptr<FileInterface> m_file;
+		Format m_format;
+		bool m_decompressed = false;
+		std::unique_ptr<uint8_t[]> m_data;
+		size_t m_size = 0;
+		mutable size_t m_position = 0;
+	};
+}
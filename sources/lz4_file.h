@@ -0,0 +1,209 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include "fsal_common.h"
+#include "FileInterface.h"
+
+#include <memory>
+#include <algorithm>
+#include <string.h>
+#include "lz4frame.h"
+#include "common.h"
+
+
+namespace fsal
+{
+	// Decompresses file in LZ4 frame format. Concatenated frames are read as one stream.
+	// Seeking forward decompresses everything in between, seeking backward restarts from the beginning of the file.
+	class Lz4File : public FileInterface
+	{
+		enum
+		{
+			buff_size = 256 * 1024,
+			direct_threshold = 32 * 1024
+		};
+
+	public:
+		explicit Lz4File(const std::shared_ptr<FileInterface>& compressed)
+		{
+			m_file = compressed;
+			m_input_buff.reset(new uint8_t[buff_size]);
+			m_output_buff.reset(new uint8_t[buff_size]);
+			m_src_size = m_file->GetSize();
+
+			LZ4F_errorCode_t status = LZ4F_createDecompressionContext(&m_ctx, LZ4F_VERSION);
+			if (LZ4F_isError(status))
+				throw runtime_error("Failed to init lz4: %s", LZ4F_getErrorName(status));
+		}
+
+		~Lz4File()
+		{
+			LZ4F_freeDecompressionContext(m_ctx);
+		}
+
+		bool ok() const { return m_file != nullptr; }
+
+		path GetPath() const { return m_file->GetPath(); }
+
+		Status Open(path filepath, Mode mode) { return Status::kFailed; }
+
+		Status ReadData(uint8_t* dst, size_t size, size_t* bytesRead)
+		{
+			*bytesRead = 0;
+			while (size > 0)
+			{
+				size_t data_avail = m_outputbuff_end - m_outputbuff_begin;
+				if (data_avail > 0)
+				{
+					size_t will_write_out = std::min(data_avail, size);
+					if (dst != nullptr)
+					{
+						memcpy(dst, m_output_buff.get() + m_outputbuff_begin, will_write_out);
+						dst += will_write_out;
+					}
+					size -= will_write_out;
+					*bytesRead += will_write_out;
+					m_dst_offset += will_write_out;
+					m_outputbuff_begin += will_write_out;
+				}
+				if (size == 0)
+					return Status::kOk;
+
+				// Large reads are decompressed straight to the destination
+				bool direct = dst != nullptr && size >= direct_threshold;
+				size_t decompressed = direct ? Decompress(dst, size) : Decompress(m_output_buff.get(), buff_size);
+				if (decompressed == 0)
+					return Status::kEOF;
+
+				if (direct)
+				{
+					m_outputbuff_begin = 0;
+					m_outputbuff_end = 0;
+					dst += decompressed;
+					size -= decompressed;
+					*bytesRead += decompressed;
+					m_dst_offset += decompressed;
+				}
+				else
+				{
+					m_outputbuff_begin = 0;
+					m_outputbuff_end = decompressed;
+				}
+			}
+			return Status::kOk;
+		}
+
+		Status WriteData(const uint8_t* src, size_t size) { return Status::kFailed; }
+
+		Status _SetPosition(size_t position)
+		{
+			if (position == m_dst_offset)
+				return Status::kOk;
+
+			// Data that was already consumed, but is still in the output buffer
+			if (position < m_dst_offset && m_dst_offset - position <= m_outputbuff_begin)
+			{
+				m_outputbuff_begin -= m_dst_offset - position;
+				m_dst_offset = position;
+				return Status::kOk;
+			}
+
+			if (position < m_dst_offset)
+				Restart();
+
+			size_t _bytesRead;
+			ReadData(nullptr, position - m_dst_offset, &_bytesRead);
+			return position == m_dst_offset ? Status::kOk : Status::kFailed;
+		}
+
+		Status SetPosition(size_t position) const override
+		{
+			return const_cast<Lz4File*>(this)->_SetPosition(position);
+		}
+
+		size_t GetPosition() const override { return m_dst_offset; }
+
+		size_t GetSize() const override { return -1; }
+
+		Status FlushBuffer() const override { return Status::kFailed; }
+
+		uint64_t GetLastWriteTime() const override { return 0; }
+
+		const uint8_t* GetDataPointer() const override { return nullptr; }
+
+		uint8_t* GetDataPointer()  override { return nullptr; }
+
+		bool Resize(size_t newSize) { return false; }
+
+	private:
+		// Decompresses the next portion of data to `dst`, at most `size` bytes. Returns number of bytes written,
+		// zero at the end of the data.
+		size_t Decompress(uint8_t* dst, size_t size)
+		{
+			while (true)
+			{
+				// lz4 keeps the incomplete input internally, so the input buffer is only refilled once it is empty
+				if (m_inputbuff_begin == m_inputbuff_end && m_src_offset < m_src_size)
+				{
+					size_t bytes_to_read = std::min(m_src_size - m_src_offset, size_t(buff_size));
+					size_t _bytesRead = 0;
+					m_file->ReadData(m_input_buff.get(), bytes_to_read, &_bytesRead);
+					m_inputbuff_begin = 0;
+					m_inputbuff_end = _bytesRead;
+					m_src_offset += _bytesRead;
+					if (_bytesRead == 0)
+						m_src_size = m_src_offset;
+				}
+				if (m_inputbuff_begin == m_inputbuff_end)
+					return 0;
+
+				size_t dst_size = size;
+				size_t src_size = m_inputbuff_end - m_inputbuff_begin;
+				size_t result = LZ4F_decompress(m_ctx, dst, &dst_size, m_input_buff.get() + m_inputbuff_begin, &src_size, nullptr);
+				if (LZ4F_isError(result))
+					throw runtime_error("LZ4 decompression failed: %s. File: %s", LZ4F_getErrorName(result), GetPath().string().c_str());
+
+				m_inputbuff_begin += src_size;
+				if (dst_size > 0)
+					return dst_size;
+			}
+		}
+
+		void Restart()
+		{
+			LZ4F_resetDecompressionContext(m_ctx);
+			m_inputbuff_begin = 0;
+			m_inputbuff_end = 0;
+			m_outputbuff_begin = 0;
+			m_outputbuff_end = 0;
+			m_src_offset = 0;
+			m_dst_offset = 0;
+			m_src_size = m_file->GetSize();
+			m_file->SetPosition(0);
+		}
+
+		std::shared_ptr<FileInterface> m_file;
+		size_t m_src_size = 0;
+		size_t m_src_offset = 0;
+		size_t m_dst_offset = 0;
+		LZ4F_dctx* m_ctx = nullptr;
+		std::unique_ptr<uint8_t[]> m_input_buff;
+		std::unique_ptr<uint8_t[]> m_output_buff;
+		size_t m_inputbuff_begin = 0;
+		size_t m_inputbuff_end = 0;
+		size_t m_outputbuff_begin = 0;
+		size_t m_outputbuff_end = 0;
+	};
+}
@@ -32,7 +32,10 @@
 
 #include "record_readers.h"
 #include "record_yielder.h"
+#include "record_dataset.h"
+#include "record_writer.h"
 #include "example.h"
+#include "posix_file.h"
 
 
 int main()
@@ -52,6 +55,16 @@ static fsal::File openfile(const char* filename, fsal::StdFile& tmp_std)
 	return fsal::File(&tmp_std, fsal::File::borrow{});
 }
 
+// Opens file for reading with O_DIRECT, bypassing the page cache
+static fsal::File openfile_direct(const char* filename)
+{
+#ifdef _WIN32
+	throw runtime_error("Direct reading is not supported on this platform");
+#else
+	return fsal::File(new fsal::DirectFile(filename, RecordReader::DefaultBlockSize));
+#endif
+}
+
 
 static py::object read_as_bytes(const fsal::File& fp)
 {
@@ -167,6 +180,16 @@ static py::object read_jpg_as_numpy(const fsal::File& fp, bool use_turbo)
 	return result;
 }
 
+// Wraps record payload that lives in a mapped file into a read-only numpy array without copying.
+// The array keeps a reference to the file, so the mapping outlives the RecordReader if needed.
+static py::object make_record_view(const RecordReader& reader, const uint8_t* data, size_t size)
+{
+	py::capsule base(new fsal::File(reader.file()), [](void* p) { delete (fsal::File*)p; });
+	ndarray_uint8 view(std::vector<size_t>{size}, data, base);
+	py::detail::array_proxy(view.ptr())->flags &= ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+	return std::move(view);
+}
+
 PYBIND11_MODULE(_dareblopy, m)
 {
 	m.doc() = "_dareblopy - DareBlopy";
@@ -205,6 +228,7 @@ PYBIND11_MODULE(_dareblopy, m)
             * `NONE` - default
             * `GZIP`
             * `ZLIB`
+            * `LZ4` - LZ4 frame format. Decompresses several times faster than GZIP and ZLIB, at a lower compression ratio.
 
 	    Example::
 
@@ -228,8 +252,122 @@ PYBIND11_MODULE(_dareblopy, m)
 			.value("NONE", RecordReader::None)
 			.value("GZIP", RecordReader::GZIP)
 			.value("ZLIB", RecordReader::ZLIB)
+			.value("LZ4", RecordReader::LZ4)
 			.export_values();
 
+	py::enum_<RecordReader::ReadMode>(m, "ReadMode", py::arithmetic(), R"(
+	    Enumeration for the way :class:`.RecordReader` accesses the tfrecord file.
+
+	    Possible values:
+
+            * `STREAM` - default. Records are read through the file object and returned as `bytes`.
+            * `MMAP` - file is memory mapped. Records are returned as read-only numpy arrays of uint8 that
+              reference the mapping directly, without copying. Crc32 is checked in place.
+              Supported only for uncompressed tfrecords.
+            * `BUFFERED` - file is read by large blocks of `block_size` bytes, record headers and payloads are
+              sliced out of the block. Greatly reduces number of read calls for small records.
+            * `ASYNC` - `io_depth` reads of `block_size` bytes are kept in flight ahead of the current record. Uses
+              io_uring when the kernel supports it, otherwise a pool of threads doing pread. Not available on Windows.
+            * `DIRECT` - file is read with O_DIRECT, bypassing the page cache, by aligned blocks of `block_size` bytes.
+              Gives predictable throughput for datasets much larger than RAM and does not evict page cache of
+              other processes. Falls back to regular reading if the file system does not support it.
+              Not available on Windows.
+
+	    Example::
+
+                record_reader = db.RecordReader('test_utils/test-small-r00.tfrecords', mode=db.ReadMode.MMAP)
+                record = next(record_reader)
+                data = record.tobytes()
+	)")
+			.value("STREAM", RecordReader::Stream)
+			.value("MMAP", RecordReader::MMap)
+			.value("BUFFERED", RecordReader::Buffered)
+			.value("ASYNC", RecordReader::Async)
+			.value("DIRECT", RecordReader::Direct)
+			.export_values();
+
+	py::enum_<RecordReader::InflateBackend>(m, "InflateBackend", py::arithmetic(), R"(
+	    Enumeration for the decoder :class:`.RecordReader` uses for compressed tfrecords.
+
+	    Possible values:
+
+            * `ZLIB` - default. Streaming inflate of zlib, memory use does not depend on the size of the file.
+            * `LIBDEFLATE` - whole file is decompressed at once with libdeflate, which is several times faster.
+              The decompressed file is kept in memory while the reader is alive.
+
+	    Example::
+
+                record_reader = db.RecordReader('test_utils/test-small-gzip-r00.tfrecords', db.Compression.ZLIB,
+                                                inflate_backend=db.InflateBackend.LIBDEFLATE)
+	)")
+			.value("ZLIB", RecordReader::ZlibInflate)
+			.value("LIBDEFLATE", RecordReader::LibdeflateInflate);
+
+	py::enum_<RecordCompression>(m, "RecordCompression", py::arithmetic(), R"(
+	    Enumeration for compression of individual records, see :class:`.RecordWriter`. Unlike :class:`.Compression`
+	    of the whole file, such records can be decompressed in parallel and in any order. Compression is flagged in
+	    the two top bits of the record length, so files with compressed records are not valid tfrecord files anymore,
+	    they can only be read by this library. TensorFlow and other tfrecord readers fail on them.
+	    :class:`.RecordReader` detects compression from the record header, so such files are read as usual, except for
+	    ReadMode.MMAP, which can not return such records as views.
+
+	    Possible values:
+
+            * `NONE` - default. Payloads are stored as is.
+            * `LZ4` - payloads are compressed with LZ4 block format. Fast to decompress.
+            * `DEFLATE` - payloads are compressed with zlib. Better compression ratio.
+
+	    Example::
+
+                with db.RecordWriter('records.tfrecords', record_compression=db.RecordCompression.LZ4) as writer:
+                    writer.write(record)
+	)")
+			.value("NONE", RecordUncompressed)
+			.value("LZ4", RecordLZ4)
+			.value("DEFLATE", RecordDeflate);
+
+	py::enum_<RecordReader::Verification>(m, "Verification", py::arithmetic(), R"(
+	    Enumeration for crc32 verification policy of :class:`.RecordReader`.
+
+	    Possible values:
+
+            * `FULL` - default. Headers and payloads of all records are checked. Large payloads are checked in parallel.
+            * `HEADER_ONLY` - only record headers are checked, which still guards record framing.
+            * `SAMPLED` - headers of all records and payloads of every `sample_rate`-th record are checked.
+            * `NONE` - no checks.
+
+	    Example::
+
+                record_reader = db.RecordReader('test_utils/test-small-r00.tfrecords')
+                record_reader.set_verification(db.Verification.SAMPLED, sample_rate=16)
+	)")
+			.value("FULL", RecordReader::VerifyFull)
+			.value("HEADER_ONLY", RecordReader::VerifyHeaderOnly)
+			.value("SAMPLED", RecordReader::VerifySampled)
+			.value("NONE", RecordReader::VerifyNone);
+
+	py::enum_<Sharding>(m, "Sharding", py::arithmetic(), R"(
+	    Enumeration for the way record yielders split data between data-parallel workers, see `shard_index` and
+	    `num_shards` arguments of :class:`.RecordYielderBasic`.
+
+	    Possible values:
+
+            * `FILE` - default. Each worker reads every `num_shards`-th file. Randomized yielders pick files after the
+              seeded shuffle, so with the same seed workers get disjoint sets of files, which change every epoch.
+            * `RECORD` - each worker reads every `num_shards`-th record of all files, numbered across files, so that
+              workers get the same number of records, give or take one. Useful when there are fewer files than
+              workers. Records of other workers are skipped using the record index if its sidecar exists
+              (see :meth:`.RecordReader.load_index`), otherwise by record headers, without reading payloads.
+              With prefetching or interleaving all records are read, and records of other workers are dropped.
+
+	    Example::
+
+                record_yielder = db.RecordYielderBasic(filenames, shard_index=rank, num_shards=world_size,
+                                                       sharding=db.Sharding.RECORD)
+	)")
+			.value("FILE", ShardFiles)
+			.value("RECORD", ShardRecords);
+
 	py::class_<RecordReader>(m, "RecordReader", R"(
 	    An iterator that reads tfrecord file and returns raw records (protobuffer messages).
 	    Does not support compressed tfrecords. Performs crc32 check of read data.
@@ -238,10 +376,23 @@ PYBIND11_MODULE(_dareblopy, m)
 	    	    file (File): a :ref:`.File` fileobject.
 	    	    filename (str): a filename of the file.
 	    	    compression (Compression, optional): compression type. Default is Compression.None.
+	    	    mode (ReadMode, optional): file access mode. Default is ReadMode.STREAM.
+	    	    block_size (int, optional): size of the block in bytes for ReadMode.BUFFERED, ReadMode.ASYNC and ReadMode.DIRECT. Default is 1MiB.
+	    	    io_depth (int, optional): number of reads in flight for ReadMode.ASYNC. Default is 8.
+	    	    advise (bool, optional): if True, kernel is told that the file is read sequentially: readahead is increased,
+	    	                             data ahead of the current record is requested, and consumed data is evicted
+	    	                             from the page cache. Useful for streaming datasets larger than RAM.
+	    	                             All hints are given on Linux. On macOS only readahead is requested and
+	    	                             nothing is evicted, except for memory mapped files. Ignored on Windows.
+	    	                             Default is False.
+	    	    inflate_backend (InflateBackend, optional): decoder for compressed tfrecords. Default is InflateBackend.ZLIB.
 
 	    Note:
 	    	    Contructor is overloaded and excepts either `file` (File) either `filename` (str)
 
+	    Note:
+	    	    In ReadMode.MMAP records are returned as read-only numpy arrays of uint8 instead of `bytes`.
+
 	    Example::
 
 	        rr = db.RecordReader('test_utils/test-small-r00.tfrecords')
@@ -253,10 +404,39 @@ PYBIND11_MODULE(_dareblopy, m)
 	        file_size, data_size, entries = rr.get_metadata()
 	        records = list(rr)
 	)")
-			.def(py::init<fsal::File, RecordReader::Compression>(), py::arg("file"), py::arg("compression") = RecordReader::None)
-			.def(py::init<const std::string&, RecordReader::Compression>(), py::arg("filename"), py::arg("compression") = RecordReader::None)
+			.def(py::init([](fsal::File file, RecordReader::Compression compression, RecordReader::ReadMode mode, size_t block_size, int io_depth, bool advise,
+			                 RecordReader::InflateBackend inflate_backend)
+			{
+				return new RecordReader(file, compression, mode, block_size, io_depth, nullptr, advise, inflate_backend);
+			}), py::arg("file"), py::arg("compression") = RecordReader::None, py::arg("mode") = RecordReader::Stream,
+			    py::arg("block_size") = (size_t)RecordReader::DefaultBlockSize, py::arg("io_depth") = (int)RecordReader::DefaultIODepth,
+			    py::arg("advise") = false, py::arg("inflate_backend") = RecordReader::ZlibInflate)
+			.def(py::init([](const std::string& filename, RecordReader::Compression compression, RecordReader::ReadMode mode, size_t block_size, int io_depth, bool advise,
+			                 RecordReader::InflateBackend inflate_backend)
+			{
+				return new RecordReader(filename, compression, mode, block_size, io_depth, nullptr, advise, inflate_backend);
+			}), py::arg("filename"), py::arg("compression") = RecordReader::None, py::arg("mode") = RecordReader::Stream,
+			    py::arg("block_size") = (size_t)RecordReader::DefaultBlockSize, py::arg("io_depth") = (int)RecordReader::DefaultIODepth,
+			    py::arg("advise") = false, py::arg("inflate_backend") = RecordReader::ZlibInflate)
 			.def("read_record", [](RecordReader& self, size_t& offset)->py::object
 			{
+				if (self.mode() == RecordReader::MMap)
+				{
+					const uint8_t* data = nullptr;
+					size_t size = 0;
+					{
+						py::gil_scoped_release release;
+
+						uint64_t _offset = offset;
+						fsal::Status result = self.ReadRecordView(_offset, data, size);
+						if (!result.ok() || result.is_eof())
+						{
+							throw runtime_error("Error reading record at offset %zd", offset);
+						}
+					}
+					return make_record_view(self, data, size);
+				}
+
 				PyBytesObject* bytesObject = nullptr;
 				{
 					py::gil_scoped_release release;
@@ -274,12 +454,89 @@ PYBIND11_MODULE(_dareblopy, m)
 			    Reads a record at specific offset. In majority of cases, you won't need this method, instead use
 			   `RecordReader` as iterator.
 			)")
+			.def("read_records", [](RecordReader& self, py::array_t<int64_t, py::array::c_style | py::array::forcecast> offsets)->py::list
+			{
+				size_t count = offsets.size();
+				std::vector<uint64_t> _offsets(offsets.data(), offsets.data() + count);
+				py::list result(count);
+
+				if (self.mode() == RecordReader::MMap)
+				{
+					std::vector<const uint8_t*> data(count, nullptr);
+					std::vector<size_t> sizes(count, 0);
+					{
+						py::gil_scoped_release release;
+						for (size_t i = 0; i < count; ++i)
+						{
+							uint64_t offset = _offsets[i];
+							fsal::Status status = self.ReadRecordView(offset, data[i], sizes[i]);
+							if (!status.ok() || status.is_eof())
+							{
+								throw runtime_error("Error reading record at offset %zd", size_t(_offsets[i]));
+							}
+						}
+					}
+					for (size_t i = 0; i < count; ++i)
+					{
+						result[i] = make_record_view(self, data[i], sizes[i]);
+					}
+					return result;
+				}
+
+				std::vector<PyBytesObject*> objects(count, nullptr);
+				{
+					py::gil_scoped_release release;
+					try
+					{
+						self.ReadRecords(_offsets, [&objects](size_t i, size_t size)
+						{
+							return GetBytesAllocator(objects[i])(size);
+						});
+					}
+					catch (...)
+					{
+						for (auto* object: objects)
+						{
+							PyObject_Free(object);
+						}
+						throw;
+					}
+				}
+				for (size_t i = 0; i < count; ++i)
+				{
+					result[i] = py::reinterpret_steal<py::object>((PyObject*)objects[i]);
+				}
+				return result;
+			}, py::arg("offsets"), R"(
+			    Reads records at given offsets with one call.
+
+			    Offsets are sorted internally and records that lie close to each other in the file are fetched with a
+			    single read. GIL is released while reading.
+
+			    Args:
+			        offsets (ndarray): array of record offsets.
+
+			    Returns:
+			        List[bytes] - records in the order of `offsets`. In ReadMode.MMAP, read-only numpy arrays of uint8.
+			)")
 			.def("__iter__", [](py::object& self)->py::object
 			{
 				return self;
 			})
 			.def("__next__", [](RecordReader& self)->py::object
 			{
+				if (self.mode() == RecordReader::MMap)
+				{
+					const uint8_t* data = nullptr;
+					size_t size = 0;
+					auto status = self.GetNextView(data, size);
+					if (status.is_eof())
+					{
+						throw py::stop_iteration();
+					}
+					return make_record_view(self, data, size);
+				}
+
 				PyBytesObject* bytesObject = nullptr;
 				auto status = self.GetNext(GetBytesAllocator(bytesObject));
 				if (!status.ok() || status.is_eof())
@@ -303,14 +560,239 @@ PYBIND11_MODULE(_dareblopy, m)
 			    Returns metadata of the tfrecord and checks all crc32 checksums.
 
 			    Note:
-			        It has to scan the whole file to
+			        It has to scan the whole file to check all record headers, unless the record index was loaded
+			        with :meth:`load_index`. In that case metadata is computed from the index.
 
 			    Returns:
 			        Tuple[int, int, int] - file_size, data_size, entries. Where `file_size` - size of the file,
 			        `data_size` - size of the data stored in the tfrecord, `entries` - number of entries.
 
+			)")
+			.def("set_verification", &RecordReader::SetVerification, py::arg("verification"), py::arg("sample_rate") = 1, R"(
+			    Sets crc32 verification policy, see :class:`.Verification`.
+
+			    Args:
+			        verification (Verification): verification policy.
+			        sample_rate (int, optional): for Verification.SAMPLED, payload of every `sample_rate`-th record is checked.
+			)")
+			.def("set_sharding", &RecordReader::SetSharding, py::arg("shard_index"), py::arg("num_shards"), py::arg("first_record") = 0, R"(
+			    Makes iteration return only records whose number equals `shard_index` modulo `num_shards`.
+			    Other records are skipped using the index if it is loaded (see :meth:`load_index`), otherwise by
+			    record headers, without reading payloads.
+
+			    Args:
+			        shard_index (int): index of the shard, in range [0, `num_shards`).
+			        num_shards (int): number of shards.
+			        first_record (int, optional): number of the first record of the file. To shard a sequence of files
+			                                      as one, it is the number of records in the files before this one, so
+			                                      that shards differ in size by at most one record. Default is 0.
+			)")
+			.def("start_background_inflate", &RecordReader::StartBackgroundInflate,
+			    py::arg("block_size") = (size_t)RecordReader::DefaultInflateBlockSize, py::arg("depth") = (int)RecordReader::DefaultInflateDepth, R"(
+			    Moves decompression of a compressed file to a worker thread, which stays up to `depth` blocks of
+			    `block_size` decompressed bytes ahead of the reader. Does nothing for uncompressed files.
+
+			    Inflate checkpoints are not used afterwards, so :meth:`load_index` should be called before.
+
+			    Args:
+			        block_size (int, optional): size of the decompressed block in bytes. Default is 4MiB.
+			        depth (int, optional): maximum number of decompressed blocks waiting to be read. Default is 4.
+			)")
+			.def("set_parallel_inflate", &RecordReader::SetParallelInflate, py::arg("threads"), R"(
+			    Inflates members of multi-member GZIP and ZLIB files (e.g. produced by concatenating gzip files)
+			    concurrently on `threads` threads. Zero disables it. Applies to InflateBackend.ZLIB only.
+
+			    Member boundaries are found by the scan of :meth:`load_index` and cached with inflate checkpoints,
+			    so :meth:`load_index` should be called before. Files that consist of a single member are inflated as
+			    usual.
+
+			    Example::
+
+			        rr = db.RecordReader('test_utils/test-small-gzip-r00.tfrecords', db.Compression.GZIP)
+			        rr.load_index()
+			        rr.set_parallel_inflate(8)
+			        records = list(rr)
+			)")
+			.def("load_index", [](RecordReader& self, bool build, bool save)
+			{
+				py::gil_scoped_release release;
+				return self.LoadIndex(build, save);
+			}, py::arg("build") = true, py::arg("save") = true, R"(
+			    Loads record index from the sidecar file `<filename>.index`.
+
+			    Index holds offsets and lengths of all records and is validated by size and modification time of
+			    the tfrecord file. Once index is loaded, :meth:`get_metadata` and `len` do not scan the file, and
+			    records can be accessed by their number: `rr[i]`.
+
+			    For compressed files, inflate checkpoints are also kept in `<filename>.zindex`. Decompression is
+			    resumed from the closest checkpoint, so reading a record at random position decompresses at most
+			    1MiB of data instead of everything before the record. Boundaries of members of multi-member gzip
+			    files are kept there as well, see :meth:`set_parallel_inflate`.
+
+			    Args:
+			        build (bool, optional): build the index by scanning the file if sidecar is missing or outdated.
+			        save (bool, optional): write the built index next to the tfrecord file.
+
+			    Returns:
+			        bool - True if index is available.
+			)")
+			.def("__len__", [](RecordReader& self)
+			{
+				py::gil_scoped_release release;
+				return self.GetMetadata().entries;
+			})
+			.def("__getitem__", [](RecordReader& self, ptrdiff_t number)->py::object
+			{
+				if (self.index() == nullptr)
+				{
+					throw runtime_error("Record index is not loaded. Call `load_index` first");
+				}
+				ptrdiff_t count = self.index()->size();
+				if (number < 0)
+				{
+					number += count;
+				}
+				if (number < 0 || number >= count)
+				{
+					throw py::index_error();
+				}
+
+				if (self.mode() == RecordReader::MMap)
+				{
+					const uint8_t* data = nullptr;
+					size_t size = 0;
+					{
+						py::gil_scoped_release release;
+						self.ReadRecordViewByNumber(number, data, size);
+					}
+					return make_record_view(self, data, size);
+				}
+
+				PyBytesObject* bytesObject = nullptr;
+				{
+					py::gil_scoped_release release;
+
+					fsal::Status result = self.ReadRecordByNumber(number, GetBytesAllocator(bytesObject));
+					if (!result.ok() || result.is_eof())
+					{
+						PyObject_Free(bytesObject);
+						throw runtime_error("Error reading record number %zd", number);
+					}
+				}
+				return py::reinterpret_steal<py::object>((PyObject*)bytesObject);
+			}, R"(
+			    Reads a record by its number. Requires record index, see :meth:`load_index`.
 			)");
 
+	py::class_<RecordWriter>(m, "RecordWriter", R"(
+	    Writes records to a tfrecord file. Compressed files can be read back with :class:`.RecordReader` given the
+	    same compression type.
+
+	    Args:
+	    	    filename (str): a filename of the file.
+	    	    compression (Compression, optional): compression type. Default is Compression.None.
+	    	    record_compression (RecordCompression, optional): compression of each record payload on its own.
+	    	        Files written with it can only be read by this library, see :class:`.RecordCompression`.
+	    	        Default is RecordCompression.NONE.
+
+	    Example::
+
+	        with db.RecordWriter('records.tfrecords', db.Compression.LZ4) as writer:
+	            for record in records:
+	                writer.write(record)
+	)")
+			.def(py::init<const std::string&, RecordReader::Compression, RecordCompression>(), py::arg("filename"),
+			     py::arg("compression") = RecordReader::None, py::arg("record_compression") = RecordUncompressed)
+			.def("write", [](RecordWriter& self, py::bytes record)
+			{
+				char* data = nullptr;
+				ssize_t size = 0;
+				PyBytes_AsStringAndSize(record.ptr(), &data, &size);
+				py::gil_scoped_release release;
+				self.WriteRecord((const uint8_t*)data, size);
+			}, py::arg("record"), R"(
+			    Appends a record to the file.
+
+			    Args:
+			        record (bytes): a record, usually a serialized protobuffer message.
+			)")
+			.def("close", &RecordWriter::Close, R"(
+			    Flushes compressed data and closes the file. Called automatically when the writer is destroyed.
+			)")
+			.def("__enter__", [](py::object& self)->py::object
+			{
+				return self;
+			})
+			.def("__exit__", [](RecordWriter& self, py::object, py::object, py::object)
+			{
+				self.Close();
+			});
+
+	m.def("get_metadata_many", [](const std::vector<std::string>& filenames, int threads, RecordReader::Compression compression, bool use_index)
+	{
+		size_t count = filenames.size();
+		ndarray_int64 file_size(std::vector<size_t>{count});
+		ndarray_int64 data_size(std::vector<size_t>{count});
+		ndarray_int64 entries(std::vector<size_t>{count});
+		int64_t* file_size_ptr = (int64_t*)file_size.request().ptr;
+		int64_t* data_size_ptr = (int64_t*)data_size.request().ptr;
+		int64_t* entries_ptr = (int64_t*)entries.request().ptr;
+
+		std::string error;
+		{
+			py::gil_scoped_release release;
+			std::mutex error_mutex;
+
+			#pragma omp parallel for schedule(dynamic) num_threads(std::max(threads, 1))
+			for (int i = 0; i < int(count); ++i)
+			{
+				try
+				{
+					RecordReader reader(filenames[i], compression);
+					if (use_index)
+					{
+						reader.LoadIndex();
+					}
+					auto meta = reader.GetMetadata();
+					file_size_ptr[i] = meta.file_size;
+					data_size_ptr[i] = meta.data_size;
+					entries_ptr[i] = meta.entries;
+				}
+				catch (const std::exception& e)
+				{
+					std::lock_guard<std::mutex> lock(error_mutex);
+					if (error.empty())
+					{
+						error = e.what();
+					}
+				}
+			}
+		}
+		if (!error.empty())
+		{
+			throw runtime_error("%s", error.c_str());
+		}
+		return std::make_tuple(file_size, data_size, entries);
+	}, py::arg("filenames"), py::arg("threads") = 8, py::arg("compression") = RecordReader::None, py::arg("use_index") = false, R"(
+	    Returns metadata of many tfrecord files. Files are scanned concurrently, with GIL released.
+
+	    Args:
+	        filenames (List[str]): a list of filenames of the tfrecord files.
+	        threads (int, optional): number of threads. Default is 8.
+	        compression (Compression, optional): compression type. Default is Compression.None.
+	        use_index (bool, optional): use record index sidecar files, see :meth:`RecordReader.load_index`.
+	                                    Missing or outdated indices are built and saved.
+
+	    Returns:
+	        Tuple[ndarray, ndarray, ndarray] - arrays of int64: file_size, data_size, entries, one item per file.
+	        See :meth:`RecordReader.get_metadata`.
+
+	    Example::
+
+	        file_size, data_size, entries = db.get_metadata_many(filenames, threads=16)
+	        epoch_length = entries.sum()
+	)");
+
 	py::class_<Records::RecordParser::FixedLenFeature>(m, "FixedLenFeature", R"(
         An iterator that reads a list of tfrecord files and returns single or a batch of records).
         Does not support compressed tfrecords. Performs crc32 check of read data.
@@ -356,15 +838,129 @@ PYBIND11_MODULE(_dareblopy, m)
 			.def("parse_single_example", &Records::RecordParser::ParseSingleExample)
 			.def("parse_example", &Records::RecordParser::ParseExample);
 
+	py::class_<RecordDataset>(m, "RecordDataset", R"(
+	    Random access to records of a list of tfrecord files, as if they were one sequence of records.
+
+	    Record indices of all files are loaded (or built and saved, see :meth:`RecordReader.load_index`) in parallel
+	    on construction. Global record number is mapped to a file and offset with an in-memory table, so records can
+	    be read in any order, e.g. for a global shuffle or a map-style PyTorch dataset.
+
+	    Args:
+	    	    filenames (List[str]): a list of filenames of the tfrecord files.
+	    	    compression (Compression, optional): compression type. Default is Compression.None.
+	    	    mode (ReadMode, optional): file access mode of the readers. Default is ReadMode.STREAM.
+	    	    max_open_files (int, optional): number of files that are kept open. Default is 16.
+	    	    threads (int, optional): number of threads used to load indices. Default is 8.
+	    	    save_index (bool, optional): save built indices next to the tfrecord files. Default is True. If False,
+	    	        compressed files are scanned again each time they are opened, to rebuild inflate checkpoints.
+
+	    Example::
+
+	        dataset = db.RecordDataset(filenames)
+	        for i in np.random.permutation(len(dataset)):
+	            record = dataset[i]
+	)")
+			.def(py::init([](const std::vector<std::string>& filenames, RecordReader::Compression compression, RecordReader::ReadMode mode,
+			                 int max_open_files, int threads, bool save_index)
+			{
+				py::gil_scoped_release release;
+				return new RecordDataset(filenames, compression, mode, max_open_files, threads, save_index);
+			}), py::arg("filenames"), py::arg("compression") = RecordReader::None, py::arg("mode") = RecordReader::Stream,
+			    py::arg("max_open_files") = 16, py::arg("threads") = 8, py::arg("save_index") = true)
+			.def("__len__", &RecordDataset::size)
+			.def("__getitem__", [](RecordDataset& self, ptrdiff_t number)->py::object
+			{
+				ptrdiff_t count = self.size();
+				if (number < 0)
+				{
+					number += count;
+				}
+				if (number < 0 || number >= count)
+				{
+					throw py::index_error();
+				}
+
+				PyBytesObject* bytesObject = nullptr;
+				{
+					py::gil_scoped_release release;
+
+					fsal::Status result = self.ReadRecord(number, GetBytesAllocator(bytesObject));
+					if (!result.ok() || result.is_eof())
+					{
+						PyObject_Free(bytesObject);
+						throw runtime_error("Error reading record number %zd", number);
+					}
+				}
+				return py::reinterpret_steal<py::object>((PyObject*)bytesObject);
+			})
+			.def("read_records", [](RecordDataset& self, py::array_t<int64_t, py::array::c_style | py::array::forcecast> numbers)->py::list
+			{
+				size_t count = numbers.size();
+				std::vector<size_t> _numbers(numbers.data(), numbers.data() + count);
+				std::vector<PyBytesObject*> objects(count, nullptr);
+				{
+					py::gil_scoped_release release;
+					try
+					{
+						self.ReadRecords(_numbers, [&objects](size_t i, size_t size)
+						{
+							return GetBytesAllocator(objects[i])(size);
+						});
+					}
+					catch (...)
+					{
+						for (auto* object: objects)
+						{
+							PyObject_Free(object);
+						}
+						throw;
+					}
+				}
+				py::list result(count);
+				for (size_t i = 0; i < count; ++i)
+				{
+					result[i] = py::reinterpret_steal<py::object>((PyObject*)objects[i]);
+				}
+				return result;
+			}, py::arg("numbers"), R"(
+			    Reads records by their global numbers with one call. Records of the same file are read together,
+			    see :meth:`RecordReader.read_records`.
+
+			    Args:
+			        numbers (ndarray): array of record numbers.
+
+			    Returns:
+			        List[bytes] - records in the order of `numbers`.
+			)");
+
 	py::class_<RecordYielderBasic>(m, "RecordYielderBasic", R"(
 	    Generator that yields records from a list of tfrecord files.
 
 	    Args:
 	    	    filenames (List[str]): a list of filenames of the tfrecord files.
 	    	    compression (Compression, optional): compression type. Default is Compression.None.
+	    	    io_depth (int, optional): if greater than zero, files are read asynchronously (see ReadMode.ASYNC) with
+	    	                              `io_depth` reads in flight. Reading of the next file starts before the current
+	    	                              one is consumed. Default is 0, synchronous reading.
+	    	    advise (bool, optional): if True, kernel readahead and page cache eviction hints are given for the files,
+	    	                             see :class:`.RecordReader`. Default is False.
+	    	    background_inflate (bool, optional): if True, compressed files are decompressed on a worker thread, several
+	    	                                         MiB ahead of the consumer. Default is False.
+	    	    prefetch_depth (int, optional): if positive, records are read and checked by background threads, without
+	    	                                    the GIL, up to `prefetch_depth` records ahead per file being read. `next_n`
+	    	                                    then only takes records that are ready. Default is 0, reading is done
+	    	                                    by the calling thread.
+	    	    reader_threads (int, optional): with `prefetch_depth`, number of files read concurrently, each by its own
+	    	                                    thread. Records are still yielded in the order of files. Default is 1.
+	    	    shard_index (int, optional): index of the shard to read, in range [0, `num_shards`). Default is 0.
+	    	    num_shards (int, optional): number of shards data is split to, e.g. number of data-parallel workers.
+	    	                                Default is 1, no sharding.
+	    	    sharding (Sharding, optional): how data is split to shards. Default is Sharding.FILE.
 
 	)")
-			.def(py::init<std::vector<std::string>&, RecordReader::Compression>(), py::arg("filenames"), py::arg("compression") = RecordReader::None)
+			.def(py::init<std::vector<std::string>&, RecordReader::Compression, int, bool, bool, int, int, int, int, Sharding>(), py::arg("filenames"), py::arg("compression") = RecordReader::None, py::arg("io_depth") = 0,
+			        py::arg("advise") = false, py::arg("background_inflate") = false, py::arg("prefetch_depth") = 0, py::arg("reader_threads") = 1,
+			        py::arg("shard_index") = 0, py::arg("num_shards") = 1, py::arg("sharding") = ShardFiles)
 			.def("__iter__", [](py::object& self)->py::object
 			{
 				return self;
@@ -380,16 +976,69 @@ PYBIND11_MODULE(_dareblopy, m)
 	    	    buffer_size (Int): Size of the buffer is in number of samples. Reading of data from tfrecords to this buffer is sequential, but order of tfrecords is picked at random.
 	    	    	    	       Samples from this buffer are sampled at random. The more is the size of the buffer, the smaller are tf records, the more random is sample yielding.
 	                               Similar to https://www.tensorflow.org/api_docs/python/tf/data/Dataset#shuffle
+	                               Can be 0 if `buffer_bytes` is given.
 	    	    seed (Int): seed for random number generator
 	    	    compression (Compression, optional): compression type. Default is Compression.None.
+	    	    advise (bool, optional): if True, kernel readahead and page cache eviction hints are given for the files,
+	    	                             see :class:`.RecordReader`. Default is False.
+	    	    background_inflate (bool, optional): if True, compressed files are decompressed on a worker thread, several
+	    	                                         MiB ahead of the consumer. Default is False.
+	    	    prefetch_depth (int, optional): if positive, records are read, checked and put to the buffer by background
+	    	                                    threads, without the GIL. Up to `prefetch_depth` records are read ahead per
+	    	                                    file being read. `next_n` then only takes records that are ready. Records
+	    	                                    are yielded in the same order as without prefetching. Default is 0.
+	    	    reader_threads (int, optional): with `prefetch_depth`, number of files read concurrently, each by its own
+	    	                                    thread. Default is 1.
+	    	    cycle_length (int, optional): number of files read at once, interleaving their records into the buffer.
+	    	                                  A file that is read to the end is replaced by the next one. Values greater
+	    	                                  than 1 enable prefetching, each open file is read by its own thread.
+	    	                                  Default is 1, files are read one after another.
+	    	    block_length (int, optional): with `cycle_length`, number of consecutive records taken from each open
+	    	                                  file in turn. Default is 1.
+	    	    shard_index (int, optional): index of the shard to read, in range [0, `num_shards`). Default is 0.
+	    	    num_shards (int, optional): number of shards data is split to, e.g. number of data-parallel workers.
+	    	                                Default is 1, no sharding.
+	    	    sharding (Sharding, optional): how data is split to shards. Default is Sharding.FILE.
+	    	    buffer_bytes (int, optional): limit of the total size of records in the buffer, in bytes. Together with
+	    	                                  `buffer_size`, the buffer is full once either limit is reached. Useful when
+	    	                                  record sizes vary widely. The record crossing the limit is still buffered.
+	    	                                  Default is 0, no limit. See :meth:`resident_bytes`.
 
 	)")
-			.def(py::init<std::vector<std::string>&, int, uint64_t, int, RecordReader::Compression>(),
-			        py::arg("filenames"),  py::arg("buffer_size"),  py::arg("seed"),  py::arg("epoch"), py::arg("compression") = RecordReader::None)
+			.def(py::init<std::vector<std::string>&, int, uint64_t, int, RecordReader::Compression, bool, bool, int, int, int, int, int, int, Sharding, uint64_t>(),
+			        py::arg("filenames"),  py::arg("buffer_size"),  py::arg("seed"),  py::arg("epoch"), py::arg("compression") = RecordReader::None,
+			        py::arg("advise") = false, py::arg("background_inflate") = false, py::arg("prefetch_depth") = 0, py::arg("reader_threads") = 1,
+			        py::arg("cycle_length") = 1, py::arg("block_length") = 1, py::arg("shard_index") = 0, py::arg("num_shards") = 1,
+			        py::arg("sharding") = ShardFiles, py::arg("buffer_bytes") = 0)
 			.def("__iter__", [](py::object& self)->py::object
 			{
 				return self;
 			})
+			.def("resident_bytes", &RecordYielderRandomized::ResidentBytes, R"(
+			    Returns memory held by the shuffle buffer in bytes, including per record overhead.
+			)")
+			.def("get_state", &RecordYielderRandomized::GetState, py::arg("include_buffer") = false, R"(
+			    Returns the position of the yielder in the epoch, which :meth:`set_state` restores, e.g. to resume a
+			    preempted job mid-epoch without re-reading the consumed data. The state is a picklable dict with the
+			    shuffled list of files, the current file with the offset in it, the state of the random generator
+			    and the locations of records in the shuffle buffer.
+
+			    Not available with prefetching or interleaving.
+
+			    Args:
+			        include_buffer (bool, optional): if True, contents of the shuffle buffer are included as well.
+			                                         Otherwise buffered records are read again by :meth:`set_state`.
+			                                         Default is False.
+			)")
+			.def("set_state", &RecordYielderRandomized::SetState, py::arg("state"), R"(
+			    Restores the position saved by :meth:`get_state`. The yielder must be created with the same arguments
+			    as the one the state was taken from. The current file is sought to the saved offset, the shuffle buffer
+			    is restored from the state or read from the saved locations, then yielding continues with the same
+			    records as the original yielder would have yielded.
+
+			    Args:
+			        state (dict): state returned by :meth:`get_state`.
+			)")
 			.def("__next__", &RecordYielderRandomized::GetNext, py::return_value_policy::take_ownership)
 			.def("next_n", &RecordYielderRandomized::GetNextN, py::return_value_policy::take_ownership);
 
@@ -403,47 +1052,175 @@ PYBIND11_MODULE(_dareblopy, m)
 	    	    buffer_size (Int): Size of the buffer is in number of samples. Reading of data from tfrecords to this buffer is sequential, but order of tfrecords is picked at random.
 	    	    	    	       Samples from this buffer are sampled at random. The more is the size of the buffer, the smaller are tf records, the more random is sample yielding.
 	                               Similar to https://www.tensorflow.org/api_docs/python/tf/data/Dataset#shuffle
+	                               Can be 0 if `buffer_bytes` is given.
 	    	    seed (Int): seed for random number generator
 	    	    compression (Compression, optional): compression type. Default is Compression.None.
+	    	    advise (bool, optional): if True, kernel readahead and page cache eviction hints are given for the files,
+	    	                             see :class:`.RecordReader`. Default is False.
+	    	    background_inflate (bool, optional): if True, compressed files are decompressed on a worker thread, several
+	    	                                         MiB ahead of the consumer. Default is False.
+	    	    shard_index (int, optional): index of the shard to read, in range [0, `num_shards`). Default is 0.
+	    	    num_shards (int, optional): number of shards data is split to, e.g. number of data-parallel workers.
+	    	                                Default is 1, no sharding.
+	    	    sharding (Sharding, optional): how data is split to shards. Default is Sharding.FILE.
+	    	    buffer_bytes (int, optional): limit of the total size of records in the buffer, in bytes. Together with
+	    	                                  `buffer_size`, the buffer is full once either limit is reached. Useful when
+	    	                                  record sizes vary widely. The record crossing the limit is still buffered.
+	    	                                  Default is 0, no limit. See :meth:`resident_bytes`.
+	    	    slab_size (int, optional): largest size of the memory blocks buffered records are stored in, in bytes.
+	    	                               Smaller blocks release memory sooner when the buffer shrinks. Default is 16MiB.
 
 	)")
-			.def(py::init<py::object, std::vector<std::string>&, int, uint64_t, int, RecordReader::Compression>(),
-			        py::arg("parser"), py::arg("filenames"),  py::arg("buffer_size"),  py::arg("seed"),  py::arg("epoch"), py::arg("compression") = RecordReader::None)
+			.def(py::init<py::object, std::vector<std::string>&, int, uint64_t, int, RecordReader::Compression, bool, bool, int, int, Sharding, uint64_t, uint64_t>(),
+			        py::arg("parser"), py::arg("filenames"),  py::arg("buffer_size"),  py::arg("seed"),  py::arg("epoch"), py::arg("compression") = RecordReader::None,
+			        py::arg("advise") = false, py::arg("background_inflate") = false, py::arg("shard_index") = 0, py::arg("num_shards") = 1,
+			        py::arg("sharding") = ShardFiles, py::arg("buffer_bytes") = 0, py::arg("slab_size") = (uint64_t)RecordArena::MaxSlabSize)
 			.def("__iter__", [](py::object& self)->py::object
 			{
 				return self;
 			})
+			.def("resident_bytes", &ParsedRecordYielderRandomized::ResidentBytes, R"(
+			    Returns memory held by the shuffle buffer in bytes. Records are stored in slabs of up to `slab_size`
+			    bytes, which are compacted once they hold more than twice the size of buffered records.
+			)")
+			.def("get_state", &ParsedRecordYielderRandomized::GetState, py::arg("include_buffer") = false, R"(
+			    Returns the position of the yielder in the epoch, see :meth:`.RecordYielderRandomized.get_state`.
+			    Buffered records are saved as stored in the files, individually compressed records stay compressed.
+
+			    Args:
+			        include_buffer (bool, optional): if True, contents of the shuffle buffer are included as well.
+			                                         Default is False.
+			)")
+			.def("set_state", &ParsedRecordYielderRandomized::SetState, py::arg("state"), R"(
+			    Restores the position saved by :meth:`get_state`, see :meth:`.RecordYielderRandomized.set_state`.
+
+			    Args:
+			        state (dict): state returned by :meth:`get_state`.
+			)")
 			.def("__next__", &ParsedRecordYielderRandomized::GetNext, py::return_value_policy::take_ownership)
 			.def("next_n", &ParsedRecordYielderRandomized::GetNextN, py::return_value_policy::take_ownership);
 
-	m.def("open_as_bytes", [](const char* filename)
+	py::class_<RecordYielderMixture>(m, "RecordYielderMixture", R"(
+	    Generator that mixes records of several datasets, e.g. 70% of web data, 20% of curated data and 10% of synthetic
+	    data. Each dataset is read by its own :class:`.RecordYielderRandomized`, with its own shuffle buffer, and every
+	    record is taken from a dataset drawn at random according to the weights.
+
+	    Args:
+	    	    sources (List[List[str]]): lists of filenames of the tfrecord files, one list per dataset.
+	    	    weights (List[float]): sampling weights of the datasets. They do not need to sum to one.
+	    	    buffer_size (Int): size of the shuffle buffer of each dataset, in number of records, see
+	    	                       :class:`.RecordYielderRandomized`.
+	    	    seed (Int): seed for random number generator. Datasets are shuffled with seeds `seed`, `seed + 1`, ...
+	    	    epoch (Int): epoch, which together with the seed defines the order of records.
+	    	    compression (Compression, optional): compression type. Default is Compression.None.
+	    	    restart (bool, optional): if True, a dataset that is read to the end starts over, shuffled as its next
+	    	                              epoch, so that the proportions are kept and the mixture does not end.
+	    	                              If False, exhausted datasets are dropped and the remaining ones are drawn
+	    	                              according to their weights, until all are read. Default is False.
+	    	    buffer_bytes (int, optional): limit of the total size of records in the shuffle buffer of each dataset.
+	    	                                  Default is 0, no limit.
+
+	    Example::
+
+                record_yielder = db.RecordYielderMixture([web_files, curated_files, synthetic_files], [0.7, 0.2, 0.1],
+                                                         buffer_size=1024, seed=0, epoch=0, restart=True)
+                batch = record_yielder.next_n(32)
+
+	)")
+			.def(py::init<std::vector<std::vector<std::string> >&, const std::vector<double>&, int, uint64_t, int, RecordReader::Compression, bool, uint64_t>(),
+			        py::arg("sources"), py::arg("weights"), py::arg("buffer_size"), py::arg("seed"), py::arg("epoch"),
+			        py::arg("compression") = RecordReader::None, py::arg("restart") = false, py::arg("buffer_bytes") = 0)
+			.def("__iter__", [](py::object& self)->py::object
+			{
+				return self;
+			})
+			.def("__next__", &RecordYielderMixture::GetNext, py::return_value_policy::take_ownership)
+			.def("next_n", &RecordYielderMixture::GetNextN, py::return_value_policy::take_ownership);
+
+	py::class_<RecordYielderGlobalShuffle>(m, "RecordYielderGlobalShuffle", R"(
+	    Generator that yields all records of a list of tfrecord files in a random order, which is not limited by the
+	    size of a shuffle buffer as with :class:`.RecordYielderRandomized`, e.g. for files sorted by class.
+
+	    Record indices of all files are loaded (or built and saved, see :class:`.RecordDataset`) on construction.
+	    Records are split into blocks of `block_size` consecutive records of a file, and order of the blocks is
+	    shuffled. Then records of each `window` consecutive blocks are shuffled together, so each window is read from
+	    at most `window` places of the files, in order of offsets. Larger blocks make reading faster, smaller blocks
+	    and larger windows make the order more random.
+
+	    Windows are read ahead in the planned order by a background thread.
+
+	    Args:
+	    	    filenames (List[str]): a list of filenames of the tfrecord files.
+	    	    seed (Int): seed for random number generator.
+	    	    epoch (Int): epoch, which together with the seed defines the order of records.
+	    	    compression (Compression, optional): compression type. Default is Compression.None.
+	    	    block_size (int, optional): number of consecutive records of a file that are read together. Default is 64.
+	    	    window (int, optional): number of blocks, which records are shuffled together. Default is 16.
+	    	    prefetch_windows (int, optional): number of windows that are read ahead. Default is 2.
+	    	    max_open_files (int, optional): number of files that are kept open. Default is 16.
+	    	    threads (int, optional): number of threads used to load indices. Default is 8.
+	    	    save_index (bool, optional): save built indices next to the tfrecord files. Default is True. If False,
+	    	        compressed files are scanned again each time they are opened, to rebuild inflate checkpoints.
+	    	    shard_index (int, optional): index of the shard of this worker. Default is 0.
+	    	    num_shards (int, optional): number of shards. Shuffled blocks are split between shards, so each worker
+	    	                                gets a different part of the dataset in every epoch, given the same seed.
+	    	                                Default is 1.
+
+	    Example::
+
+                record_yielder = db.RecordYielderGlobalShuffle(filenames, seed=0, epoch=epoch)
+                for record in record_yielder:
+                    ...
+
+	)")
+			.def(py::init([](const std::vector<std::string>& filenames, uint64_t seed, int epoch, RecordReader::Compression compression,
+			                 int block_size, int window, int prefetch_windows, int max_open_files, int threads, bool save_index,
+			                 int shard_index, int num_shards)
+			{
+				py::gil_scoped_release release;
+				return new RecordYielderGlobalShuffle(filenames, seed, epoch, compression, block_size, window, prefetch_windows,
+				                                      max_open_files, threads, save_index, shard_index, num_shards);
+			}), py::arg("filenames"), py::arg("seed"), py::arg("epoch"), py::arg("compression") = RecordReader::None,
+			    py::arg("block_size") = 64, py::arg("window") = 16, py::arg("prefetch_windows") = 2, py::arg("max_open_files") = 16,
+			    py::arg("threads") = 8, py::arg("save_index") = true, py::arg("shard_index") = 0, py::arg("num_shards") = 1)
+			.def("__len__", &RecordYielderGlobalShuffle::size)
+			.def("__iter__", [](py::object& self)->py::object
+			{
+				return self;
+			})
+			.def("__next__", &RecordYielderGlobalShuffle::GetNext, py::return_value_policy::take_ownership)
+			.def("next_n", &RecordYielderGlobalShuffle::GetNextN, py::return_value_policy::take_ownership);
+
+	m.def("open_as_bytes", [](const char* filename, bool direct)
 	{
 		py::gil_scoped_release release;
 		fsal::StdFile tmp_std;
-		auto fp = openfile(filename, tmp_std);
+		auto fp = direct ? openfile_direct(filename) : openfile(filename, tmp_std);
 		return read_as_bytes(fp);
-	}, R"(
+	},  py::arg("filename"),  py::arg("direct") = false, R"(
 	    Opens file as bytes object
 
 	    Args:
                 filename (str): filename
+                direct (bool): if True, file is read with O_DIRECT bypassing the page cache, see ReadMode.DIRECT
 	)");
 
-	m.def("open_as_numpy_ubyte", [](const char* filename, py::object shape)
+	m.def("open_as_numpy_ubyte", [](const char* filename, py::object shape, bool direct)
 	{
 		fsal::StdFile tmp_std;
 		fsal::File fp;
 		{
 			py::gil_scoped_release release;
-			fp = openfile(filename, tmp_std);
+			fp = direct ? openfile_direct(filename) : openfile(filename, tmp_std);
 		}
 		return read_as_numpy_ubyte(fp, shape);
-	},  py::arg("filename"),  py::arg("shape").none(true) = py::none(), R"(
+	},  py::arg("filename"),  py::arg("shape").none(true) = py::none(), py::arg("direct") = false, R"(
 	    Opens file as numby array of type np.ubyte
 
 	    Args:
                 filename (str): filename
                 shape (List[Int]): shape
+                direct (bool): if True, file is read with O_DIRECT bypassing the page cache, see ReadMode.DIRECT
 	)");
 
 	m.def("read_jpg_as_numpy", [](const char* filename, bool use_turbo)
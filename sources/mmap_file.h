@@ -0,0 +1,168 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include "fsal_common.h"
+#include "FileInterface.h"
+
+#include <string.h>
+#include <algorithm>
+#include "common.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace fsal
+{
+	// Read-only memory mapped file. Exposes the mapping through GetDataPointer, so that consumers can
+	// access the content in place without copying it through ReadData.
+	class MMapFile : public FileInterface
+	{
+	public:
+		explicit MMapFile(const path& filepath): m_path(filepath)
+		{
+#ifdef _WIN32
+			m_handle = CreateFileW(filepath.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (m_handle == INVALID_HANDLE_VALUE)
+				throw runtime_error("Can't open file for mapping: %s", filepath.string().c_str());
+
+			LARGE_INTEGER size;
+			GetFileSizeEx(m_handle, &size);
+			m_size = size.QuadPart;
+
+			FILETIME write_time;
+			GetFileTime(m_handle, nullptr, nullptr, &write_time);
+			m_last_write_time = (uint64_t(write_time.dwHighDateTime) << 32) | write_time.dwLowDateTime;
+
+			if (m_size > 0)
+			{
+				m_mapping = CreateFileMappingW(m_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (m_mapping == nullptr)
+				{
+					CloseHandle(m_handle);
+					throw runtime_error("Failed to map file: %s", filepath.string().c_str());
+				}
+				m_data = (const uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+				if (m_data == nullptr)
+				{
+					CloseHandle(m_mapping);
+					CloseHandle(m_handle);
+					throw runtime_error("Failed to map file: %s", filepath.string().c_str());
+				}
+			}
+#else
+			m_fd = open(filepath.string().c_str(), O_RDONLY);
+			if (m_fd < 0)
+				throw runtime_error("Can't open file for mapping: %s", filepath.string().c_str());
+
+			struct stat st;
+			fstat(m_fd, &st);
+			m_size = st.st_size;
+			m_last_write_time = st.st_mtime;
+
+			if (m_size > 0)
+			{
+				void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+				if (data == MAP_FAILED)
+				{
+					close(m_fd);
+					throw runtime_error("Failed to map file: %s", filepath.string().c_str());
+				}
+				m_data = (const uint8_t*)data;
+			}
+#endif
+		}
+
+		~MMapFile()
+		{
+#ifdef _WIN32
+			if (m_data)
+				UnmapViewOfFile(m_data);
+			if (m_mapping)
+				CloseHandle(m_mapping);
+			CloseHandle(m_handle);
+#else
+			if (m_data)
+				munmap((void*)m_data, m_size);
+			close(m_fd);
+#endif
+		}
+
+#ifndef _WIN32
+		int fd() const { return m_fd; }
+#endif
+
+		bool ok() const { return m_data != nullptr || m_size == 0; }
+
+		path GetPath() const { return m_path; }
+
+		Status Open(path filepath, Mode mode) { return Status::kFailed; }
+
+		Status ReadData(uint8_t* dst, size_t size, size_t* bytesRead)
+		{
+			size_t will_read = std::min(size, m_size - m_offset);
+			memcpy(dst, m_data + m_offset, will_read);
+			m_offset += will_read;
+			*bytesRead = will_read;
+			if (will_read < size)
+				return Status::kEOF;
+			return Status::kOk;
+		}
+
+		Status WriteData(const uint8_t* src, size_t size) { return Status::kFailed; }
+
+		Status SetPosition(size_t position) const override
+		{
+			if (position > m_size)
+				return Status::kFailed;
+			m_offset = position;
+			return Status::kOk;
+		}
+
+		size_t GetPosition() const override { return m_offset; }
+
+		size_t GetSize() const override { return m_size; }
+
+		Status FlushBuffer() const override { return Status::kFailed; }
+
+		uint64_t GetLastWriteTime() const override { return m_last_write_time; }
+
+		const uint8_t* GetDataPointer() const override { return m_data; }
+
+		uint8_t* GetDataPointer()  override { return nullptr; }
+
+		bool Resize(size_t newSize) { return false; }
+
+	private:
+		path m_path;
+		const uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+		mutable size_t m_offset = 0;
+		uint64_t m_last_write_time = 0;
+#ifdef _WIN32
+		HANDLE m_handle = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+#else
+		int m_fd = -1;
+#endif
+	};
+}
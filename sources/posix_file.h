@@ -0,0 +1,333 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include "fsal_common.h"
+#include "FileInterface.h"
+
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <memory>
+#include "common.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+
+namespace fsal
+{
+	// Read-only file that reads with pread on a plain file descriptor. Unlike StdFile, the descriptor is
+	// exposed, so that kernel hints can be given for it.
+	class PosixFile : public FileInterface
+	{
+	public:
+		explicit PosixFile(const path& filepath): m_path(filepath)
+		{
+			m_fd = open(filepath.string().c_str(), O_RDONLY);
+			if (m_fd < 0)
+				throw runtime_error("Can't open file: %s", filepath.string().c_str());
+
+			struct stat st;
+			fstat(m_fd, &st);
+			m_size = st.st_size;
+			m_last_write_time = st.st_mtime;
+		}
+
+		~PosixFile()
+		{
+			close(m_fd);
+		}
+
+		int fd() const { return m_fd; }
+
+		bool ok() const { return m_fd >= 0; }
+
+		path GetPath() const { return m_path; }
+
+		Status Open(path filepath, Mode mode) { return Status::kFailed; }
+
+		Status ReadData(uint8_t* dst, size_t size, size_t* bytesRead)
+		{
+			*bytesRead = 0;
+			while (size > 0)
+			{
+				ssize_t r = pread(m_fd, dst, size, m_position);
+				if (r < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					return Status::kFailed;
+				}
+				if (r == 0)
+					return Status::kEOF;
+				dst += r;
+				size -= r;
+				m_position += r;
+				*bytesRead += r;
+			}
+			return Status::kOk;
+		}
+
+		Status WriteData(const uint8_t* src, size_t size) { return Status::kFailed; }
+
+		Status SetPosition(size_t position) const override
+		{
+			if (position > m_size)
+				return Status::kFailed;
+			m_position = position;
+			return Status::kOk;
+		}
+
+		size_t GetPosition() const override { return m_position; }
+
+		size_t GetSize() const override { return m_size; }
+
+		Status FlushBuffer() const override { return Status::kFailed; }
+
+		uint64_t GetLastWriteTime() const override { return m_last_write_time; }
+
+		const uint8_t* GetDataPointer() const override { return nullptr; }
+
+		uint8_t* GetDataPointer()  override { return nullptr; }
+
+		bool Resize(size_t newSize) { return false; }
+
+	private:
+		path m_path;
+		int m_fd = -1;
+		size_t m_size = 0;
+		mutable size_t m_position = 0;
+		uint64_t m_last_write_time = 0;
+	};
+
+	// Pool of aligned buffers for O_DIRECT reading. Shards are opened and closed often, buffers are reused
+	// instead of being allocated for each file.
+	class AlignedBufferPool
+	{
+	public:
+		enum
+		{
+			Alignment = 4096,
+			MaxFreeBuffers = 16
+		};
+
+		static AlignedBufferPool& Get()
+		{
+			// Never destroyed, buffers may be released during static destruction
+			static AlignedBufferPool* pool = new AlignedBufferPool;
+			return *pool;
+		}
+
+		// `size` must be a multiple of Alignment. Buffer is returned to the pool once released.
+		std::shared_ptr<uint8_t> Acquire(size_t size)
+		{
+			void* ptr = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				for (size_t i = 0; i < m_free.size(); ++i)
+				{
+					if (m_free[i].first == size)
+					{
+						ptr = m_free[i].second;
+						m_free.erase(m_free.begin() + i);
+						break;
+					}
+				}
+			}
+			if (ptr == nullptr && posix_memalign(&ptr, Alignment, size) != 0)
+				throw runtime_error("Failed to allocate aligned buffer of size %zd", size);
+
+			return std::shared_ptr<uint8_t>((uint8_t*)ptr, [this, size](uint8_t* p) { Release(p, size); });
+		}
+
+	private:
+		void Release(uint8_t* ptr, size_t size)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_free.size() < MaxFreeBuffers)
+			{
+				m_free.emplace_back(size, ptr);
+			}
+			else
+			{
+				free(ptr);
+			}
+		}
+
+		std::mutex m_mutex;
+		std::vector<std::pair<size_t, void*> > m_free;
+	};
+
+	// Read-only file that bypasses the page cache (O_DIRECT). Reads are done by aligned blocks of `block_size`
+	// bytes into a buffer from AlignedBufferPool, arbitrary reads are served from that block. Large aligned reads
+	// go straight to the destination.
+	// If the file system does not support O_DIRECT, the file is read through the page cache as usual.
+	class DirectFile : public FileInterface
+	{
+	public:
+		DirectFile(const path& filepath, size_t block_size): m_path(filepath)
+		{
+			m_fd = open(filepath.string().c_str(), O_RDONLY | O_DIRECT);
+			if (m_fd < 0)
+			{
+				m_direct = false;
+				m_fd = open(filepath.string().c_str(), O_RDONLY);
+				if (m_fd < 0)
+					throw runtime_error("Can't open file: %s", filepath.string().c_str());
+			}
+#ifdef __APPLE__
+			fcntl(m_fd, F_NOCACHE, 1);
+#endif
+
+			struct stat st;
+			fstat(m_fd, &st);
+			m_size = st.st_size;
+			m_last_write_time = st.st_mtime;
+
+			const size_t alignment = AlignedBufferPool::Alignment;
+			m_block_size = std::max((block_size + alignment - 1) / alignment * alignment, alignment);
+			m_block = AlignedBufferPool::Get().Acquire(m_block_size);
+		}
+
+		~DirectFile()
+		{
+			close(m_fd);
+		}
+
+		// False if O_DIRECT is not supported and the file is read through the page cache
+		bool direct() const { return m_direct; }
+
+		bool ok() const { return m_fd >= 0; }
+
+		path GetPath() const { return m_path; }
+
+		Status Open(path filepath, Mode mode) { return Status::kFailed; }
+
+		Status ReadData(uint8_t* dst, size_t size, size_t* bytesRead)
+		{
+			const size_t alignment = AlignedBufferPool::Alignment;
+			*bytesRead = 0;
+			while (size > 0)
+			{
+				if (m_position >= m_size)
+					return Status::kEOF;
+
+				if (m_position >= m_block_offset && m_position < m_block_offset + m_block_fill)
+				{
+					size_t will_copy = std::min(size_t(m_block_offset + m_block_fill - m_position), size);
+					memcpy(dst, m_block.get() + (m_position - m_block_offset), will_copy);
+					dst += will_copy;
+					size -= will_copy;
+					m_position += will_copy;
+					*bytesRead += will_copy;
+					continue;
+				}
+
+				if (m_position % alignment == 0 && size >= m_block_size && uintptr_t(dst) % alignment == 0)
+				{
+					size_t read = ReadAligned(dst, size - size % alignment, m_position);
+					if (read == 0)
+						return Status::kEOF;
+					dst += read;
+					size -= read;
+					m_position += read;
+					*bytesRead += read;
+					continue;
+				}
+
+				uint64_t block_offset = m_position - m_position % alignment;
+				m_block_fill = ReadAligned(m_block.get(), m_block_size, block_offset);
+				m_block_offset = block_offset;
+				if (m_position >= m_block_offset + m_block_fill)
+					return Status::kEOF;
+			}
+			return Status::kOk;
+		}
+
+		Status WriteData(const uint8_t* src, size_t size) { return Status::kFailed; }
+
+		Status SetPosition(size_t position) const override
+		{
+			if (position > m_size)
+				return Status::kFailed;
+			m_position = position;
+			return Status::kOk;
+		}
+
+		size_t GetPosition() const override { return m_position; }
+
+		size_t GetSize() const override { return m_size; }
+
+		Status FlushBuffer() const override { return Status::kFailed; }
+
+		uint64_t GetLastWriteTime() const override { return m_last_write_time; }
+
+		const uint8_t* GetDataPointer() const override { return nullptr; }
+
+		uint8_t* GetDataPointer()  override { return nullptr; }
+
+		bool Resize(size_t newSize) { return false; }
+
+	private:
+		// Reads up to `size` bytes at aligned `offset`. Stops at the end of file
+		size_t ReadAligned(uint8_t* dst, size_t size, uint64_t offset)
+		{
+			size_t done = 0;
+			while (done < size && offset + done < m_size)
+			{
+				ssize_t r = pread(m_fd, dst + done, size - done, offset + done);
+				if (r < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					if (errno == EINVAL && m_direct)
+					{
+						// Alignment requirements of the device are stricter than expected
+						fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+						m_direct = false;
+						continue;
+					}
+					throw runtime_error("Read failed: %s. File: %s", strerror(errno), m_path.string().c_str());
+				}
+				if (r == 0)
+					break;
+				done += r;
+			}
+			return done;
+		}
+
+		path m_path;
+		int m_fd = -1;
+		bool m_direct = true;
+		size_t m_size = 0;
+		mutable size_t m_position = 0;
+		uint64_t m_last_write_time = 0;
+
+		std::shared_ptr<uint8_t> m_block;
+		size_t m_block_size = 0;
+		uint64_t m_block_offset = 0;
+		size_t m_block_fill = 0;
+	};
+}
+#endif
@@ -0,0 +1,107 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+
+// Tells the kernel that a file is read sequentially. On creation, readahead is switched to sequential and the
+// beginning of the file is requested. As the read position moves, the range ahead of it is requested and the range
+// behind it is evicted from the page cache, so that streaming of large datasets does not push out other cached data.
+// If the file is memory mapped, the same hints are given for the mapping.
+// All hints are advisory, failures are ignored. File hints are given on Linux. On macOS readahead is switched on
+// and requested with fcntl, but nothing is evicted, since there is no posix_fadvise. Mappings are advised on all
+// POSIX systems. Does nothing on Windows.
+class ReadAdvice
+{
+public:
+	enum
+	{
+		WillNeedWindow = 32 * 1024 * 1024,
+		DropChunk = 8 * 1024 * 1024
+	};
+
+	ReadAdvice(int fd, const uint8_t* mapping, size_t size): m_fd(fd), m_mapping(mapping), m_size(size)
+	{
+#if defined(__linux__)
+		posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(__APPLE__)
+		fcntl(m_fd, F_RDAHEAD, 1);
+#endif
+#ifndef _WIN32
+		if (m_mapping)
+			madvise((void*)m_mapping, m_size, MADV_SEQUENTIAL);
+#endif
+		WillNeed(0);
+	}
+
+	// `position` is the offset in the file up to which data was consumed
+	void Consumed(uint64_t position)
+	{
+		if (position < m_dropped)
+		{
+			// Reading restarted from an earlier position
+			m_dropped = position - position % DropChunk;
+			m_requested = position;
+		}
+		if (position >= m_dropped + DropChunk)
+		{
+			uint64_t end = position - position % DropChunk;
+#ifndef _WIN32
+			if (m_mapping)
+				madvise((void*)(m_mapping + m_dropped), end - m_dropped, MADV_DONTNEED);
+#endif
+#ifdef __linux__
+			posix_fadvise(m_fd, m_dropped, end - m_dropped, POSIX_FADV_DONTNEED);
+#endif
+			m_dropped = end;
+		}
+		if (position + WillNeedWindow / 2 > m_requested)
+		{
+			WillNeed(position);
+		}
+	}
+
+private:
+	void WillNeed(uint64_t position)
+	{
+		if (position >= m_size)
+			return;
+		uint64_t begin = position > m_requested ? position : m_requested;
+		uint64_t end = position + WillNeedWindow < m_size ? position + WillNeedWindow : m_size;
+		if (begin >= end)
+			return;
+#if defined(__linux__)
+		posix_fadvise(m_fd, begin, end - begin, POSIX_FADV_WILLNEED);
+#elif defined(__APPLE__)
+		struct radvisory advisory;
+		advisory.ra_offset = off_t(begin);
+		advisory.ra_count = int(end - begin);
+		fcntl(m_fd, F_RDADVISE, &advisory);
+#endif
+		m_requested = end;
+	}
+
+	int m_fd;
+	const uint8_t* m_mapping;
+	size_t m_size;
+	uint64_t m_dropped = 0;
+	uint64_t m_requested = 0;
+};
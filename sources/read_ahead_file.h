@@ -0,0 +1,266 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include "fsal_common.h"
+#include "FileInterface.h"
+
+#include <string.h>
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <algorithm>
+#include "common.h"
+
+
+namespace fsal
+{
+	// Reads the underlying file on a worker thread, up to `depth` blocks of `block_size` bytes ahead of the read
+	// position. Meant for decompressing files (ZlibFile), so that inflate runs in parallel with the consumer, which
+	// only copies already decompressed data.
+	// The underlying file must not be used by anyone else while it is wrapped. `on_read` is called on the worker
+	// thread after each block is read.
+	class ReadAheadFile : public FileInterface
+	{
+		struct Block
+		{
+			std::unique_ptr<uint8_t[]> data;
+			size_t size = 0;
+		};
+
+	public:
+		ReadAheadFile(const std::shared_ptr<FileInterface>& file, size_t block_size, int depth,
+		              std::function<void()> on_read = nullptr):
+			m_file(file), m_block_size(std::max(block_size, size_t(1))), m_depth(std::max(depth, 1)), m_on_read(std::move(on_read))
+		{
+			m_position = m_file->GetPosition();
+			Start();
+		}
+
+		~ReadAheadFile()
+		{
+			Stop();
+		}
+
+		// True once the worker reached the end of the underlying file
+		bool exhausted() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_eof;
+		}
+
+		bool ok() const { return m_file != nullptr; }
+
+		path GetPath() const { return m_file->GetPath(); }
+
+		Status Open(path filepath, Mode mode) { return Status::kFailed; }
+
+		Status ReadData(uint8_t* dst, size_t size, size_t* bytesRead)
+		{
+			*bytesRead = 0;
+			while (size > 0)
+			{
+				size_t data_avail = m_current.size - m_current_offset;
+				if (data_avail > 0)
+				{
+					size_t will_copy = std::min(data_avail, size);
+					if (dst != nullptr)
+					{
+						memcpy(dst, m_current.data.get() + m_current_offset, will_copy);
+						dst += will_copy;
+					}
+					size -= will_copy;
+					*bytesRead += will_copy;
+					m_current_offset += will_copy;
+					m_position += will_copy;
+					continue;
+				}
+				if (!NextBlock())
+					return Status::kEOF;
+			}
+			return Status::kOk;
+		}
+
+		Status WriteData(const uint8_t* src, size_t size) { return Status::kFailed; }
+
+		Status _SetPosition(size_t position)
+		{
+			if (position == m_position)
+				return Status::kOk;
+
+			// Inside of the current block
+			if (position < m_position && m_position - position <= m_current_offset)
+			{
+				m_current_offset -= m_position - position;
+				m_position = position;
+				return Status::kOk;
+			}
+
+			// Short jumps forward are skipped over, the worker keeps going
+			if (position > m_position && position - m_position <= m_block_size * m_depth)
+			{
+				size_t _bytesRead;
+				ReadData(nullptr, position - m_position, &_bytesRead);
+				return position == m_position ? Status::kOk : Status::kFailed;
+			}
+
+			Stop();
+			Status status = m_file->SetPosition(position);
+			m_position = m_file->GetPosition();
+			Start();
+			return status;
+		}
+
+		Status SetPosition(size_t position) const override
+		{
+			return const_cast<ReadAheadFile*>(this)->_SetPosition(position);
+		}
+
+		size_t GetPosition() const override { return m_position; }
+
+		size_t GetSize() const override { return m_file->GetSize(); }
+
+		Status FlushBuffer() const override { return Status::kFailed; }
+
+		uint64_t GetLastWriteTime() const override { return m_file->GetLastWriteTime(); }
+
+		const uint8_t* GetDataPointer() const override { return nullptr; }
+
+		uint8_t* GetDataPointer()  override { return nullptr; }
+
+		bool Resize(size_t newSize) { return false; }
+
+	private:
+		void Start()
+		{
+			m_current = Block();
+			m_current_offset = 0;
+			m_stop = false;
+			m_eof = false;
+			m_error.clear();
+			m_thread = std::thread([this]() { Worker(); });
+		}
+
+		void Stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_space_cv.notify_all();
+			if (m_thread.joinable())
+				m_thread.join();
+			for (auto& block: m_ready)
+				m_free.push_back(std::move(block.data));
+			m_ready.clear();
+			if (m_current.data)
+				m_free.push_back(std::move(m_current.data));
+		}
+
+		// Takes the next block from the worker, waits if needed. Returns false at the end of the file.
+		bool NextBlock()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_current.data)
+				m_free.push_back(std::move(m_current.data));
+			m_current = Block();
+			m_current_offset = 0;
+
+			m_ready_cv.wait(lock, [this]() { return !m_ready.empty() || m_eof; });
+			if (m_ready.empty())
+			{
+				if (!m_error.empty())
+					throw runtime_error("%s", m_error.c_str());
+				return false;
+			}
+			m_current = std::move(m_ready.front());
+			m_ready.pop_front();
+			lock.unlock();
+			m_space_cv.notify_one();
+			return true;
+		}
+
+		void Worker()
+		{
+			while (true)
+			{
+				Block block;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_space_cv.wait(lock, [this]() { return m_stop || int(m_ready.size()) < m_depth; });
+					if (m_stop)
+						return;
+					if (!m_free.empty())
+					{
+						block.data = std::move(m_free.back());
+						m_free.pop_back();
+					}
+				}
+				if (!block.data)
+					block.data.reset(new uint8_t[m_block_size]);
+
+				std::string error;
+				try
+				{
+					m_file->ReadData(block.data.get(), m_block_size, &block.size);
+					if (m_on_read)
+						m_on_read();
+				}
+				catch (const std::exception& e)
+				{
+					error = e.what();
+				}
+
+				bool eof = block.size < m_block_size || !error.empty();
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					if (block.size > 0)
+						m_ready.push_back(std::move(block));
+					else
+						m_free.push_back(std::move(block.data));
+					m_error = error;
+					m_eof = eof;
+				}
+				m_ready_cv.notify_one();
+				if (eof)
+					return;
+			}
+		}
+
+		std::shared_ptr<FileInterface> m_file;
+		size_t m_block_size;
+		int m_depth;
+		std::function<void()> m_on_read;
+
+		// Consumer side
+		Block m_current;
+		size_t m_current_offset = 0;
+		mutable size_t m_position = 0;
+
+		std::thread m_thread;
+		mutable std::mutex m_mutex;
+		std::condition_variable m_ready_cv;
+		std::condition_variable m_space_cv;
+		std::deque<Block> m_ready;
+		std::vector<std::unique_ptr<uint8_t[]> > m_free;
+		std::string m_error;
+		bool m_eof = false;
+		bool m_stop = false;
+	};
+}
@@ -0,0 +1,197 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+
+// Storage of records of a shuffle buffer. Records are bump-allocated in large slabs instead of a heap allocation per
+// record, and are referred to by handles, which are cheap to move around while shuffling.
+// A slab is reused once all its records are freed. Records taken out of the buffer at random still leave most slabs
+// partially used, so once reserved memory exceeds twice the live data, the owner is expected to call Compact, which
+// moves live records to new slabs.
+class RecordArena
+{
+public:
+	enum
+	{
+		MinSlabSize = 64 * 1024,
+		MaxSlabSize = 16 * 1024 * 1024
+	};
+
+	// Slabs grow up to `max_slab_size`, larger records get a slab of their own
+	explicit RecordArena(size_t max_slab_size = MaxSlabSize):
+		m_max_slab_size(std::max(max_slab_size, size_t(1))), m_min_slab_size(std::min(size_t(MinSlabSize), m_max_slab_size))
+	{
+	}
+
+	struct Handle
+	{
+		uint32_t slab;
+		uint64_t offset;
+		size_t size;
+	};
+
+	// Memory stays valid until the handle is freed or the arena is compacted
+	uint8_t* Allocate(size_t size, Handle& handle)
+	{
+		if (m_current == NoSlab || m_slabs[m_current].capacity - m_slabs[m_current].used < size)
+		{
+			uint32_t previous = m_current;
+			m_current = NewSlab(size);
+			if (previous != NoSlab && m_slabs[previous].records == 0)
+			{
+				Retire(previous);
+			}
+		}
+		Slab& slab = m_slabs[m_current];
+		handle.slab = m_current;
+		handle.offset = slab.used;
+		handle.size = size;
+		slab.used += size;
+		++slab.records;
+		m_live_bytes += size;
+		return slab.data.get() + handle.offset;
+	}
+
+	uint8_t* data(const Handle& handle) const
+	{
+		return m_slabs[handle.slab].data.get() + handle.offset;
+	}
+
+	void Free(const Handle& handle)
+	{
+		Slab& slab = m_slabs[handle.slab];
+		--slab.records;
+		m_live_bytes -= handle.size;
+		if (slab.records != 0)
+		{
+			return;
+		}
+
+		slab.used = 0;
+		if (handle.slab != m_current)
+		{
+			Retire(handle.slab);
+		}
+	}
+
+	// True if compaction would release a significant amount of memory
+	bool fragmented() const
+	{
+		return m_reserved_bytes > 2 * m_live_bytes + 2 * m_max_slab_size;
+	}
+
+	// Moves live records to new slabs and releases the old ones. `handle` is the member of T holding the handle.
+	// Records must hold all live handles of the arena.
+	template<typename T>
+	void Compact(std::vector<T>& records, Handle T::* handle)
+	{
+		std::vector<Slab> old;
+		old.swap(m_slabs);
+		m_free.clear();
+		m_current = NoSlab;
+		m_reserved_bytes = 0;
+		m_live_bytes = 0;
+		m_free_bytes = 0;
+
+		for (auto& record: records)
+		{
+			Handle& h = record.*handle;
+			const uint8_t* src = old[h.slab].data.get() + h.offset;
+			memcpy(Allocate(h.size, h), src, h.size);
+		}
+	}
+
+	// Memory held by slabs, including unused parts and empty slabs kept for reuse
+	size_t reserved_bytes() const { return m_reserved_bytes; }
+
+	size_t live_bytes() const { return m_live_bytes; }
+
+private:
+	enum : uint32_t { NoSlab = UINT32_MAX };
+
+	struct Slab
+	{
+		std::unique_ptr<uint8_t[]> data;
+		size_t capacity = 0;
+		size_t used = 0;
+		size_t records = 0;
+	};
+
+	// A few empty slabs are kept for reuse, oversized ones and the rest are released
+	void Retire(uint32_t index)
+	{
+		Slab& slab = m_slabs[index];
+		slab.used = 0;
+		if (slab.capacity <= m_max_slab_size && m_free_bytes + slab.capacity <= 2 * m_max_slab_size)
+		{
+			m_free.push_back(index);
+			m_free_bytes += slab.capacity;
+		}
+		else
+		{
+			m_reserved_bytes -= slab.capacity;
+			slab.data.reset();
+			slab.capacity = 0;
+		}
+	}
+
+	uint32_t NewSlab(size_t size)
+	{
+		for (auto it = m_free.rbegin(); it != m_free.rend(); ++it)
+		{
+			uint32_t index = *it;
+			if (m_slabs[index].capacity >= size)
+			{
+				m_free.erase(std::next(it).base());
+				m_free_bytes -= m_slabs[index].capacity;
+				return index;
+			}
+		}
+
+		// Slabs grow with the arena, so that small buffers do not reserve much. Large records get a slab of their own
+		size_t capacity = std::max(size, std::min(std::max(m_reserved_bytes, m_min_slab_size), m_max_slab_size));
+
+		uint32_t index = 0;
+		while (index < m_slabs.size() && m_slabs[index].data)
+		{
+			++index;
+		}
+		if (index == m_slabs.size())
+		{
+			m_slabs.emplace_back();
+		}
+		Slab& slab = m_slabs[index];
+		slab.data.reset(new uint8_t[capacity]);
+		slab.capacity = capacity;
+		slab.used = 0;
+		slab.records = 0;
+		m_reserved_bytes += capacity;
+		return index;
+	}
+
+	size_t m_max_slab_size;
+	size_t m_min_slab_size;
+	std::vector<Slab> m_slabs; // released slabs have no data, their places are reused
+	std::vector<uint32_t> m_free; // empty slabs kept for reuse
+	uint32_t m_current = NoSlab;  // slab records are allocated from
+	size_t m_reserved_bytes = 0;
+	size_t m_live_bytes = 0;
+	size_t m_free_bytes = 0;
+};
@@ -0,0 +1,122 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "record_compression.h"
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include "lz4.h"
+#include "zlib.h"
+#include "common.h"
+
+
+// Highest compression ratios the formats can reach, runs of one byte take at least one byte of lz4 per 255 bytes of
+// output, and at least two bits of deflate per 258 bytes of output
+enum
+{
+	MaxLZ4Ratio = 256,
+	MaxDeflateRatio = 1040
+};
+
+size_t GetUncompressedSize(RecordCompression compression, const uint8_t* payload, size_t size)
+{
+	if (size < sizeof(uint64_t))
+		throw runtime_error("Corrupted compressed record, payload of %zd bytes is too short", size);
+
+	uint64_t uncompressed_size = 0;
+	memcpy(&uncompressed_size, payload, sizeof(uint64_t));
+
+	// Size is checked before anything is allocated for it, a corrupted one could ask for any amount of memory
+	uint64_t src_size = size - sizeof(uint64_t);
+	uint64_t max_size = kRecordLengthMask;
+	switch (compression)
+	{
+		case RecordLZ4:
+			max_size = std::min<uint64_t>(LZ4_MAX_INPUT_SIZE, src_size * MaxLZ4Ratio + 64);
+			break;
+		case RecordDeflate:
+			max_size = std::min<uint64_t>(kRecordLengthMask, src_size * MaxDeflateRatio + 64);
+			break;
+		default:
+			throw runtime_error("Unknown record compression %d", int(compression));
+	}
+	if (uncompressed_size > max_size || uncompressed_size >= SIZE_MAX - sizeof(uint32_t))
+		throw runtime_error("Corrupted compressed record, uncompressed size %zd is too large for a payload of %zd bytes", size_t(uncompressed_size), size);
+	return uncompressed_size;
+}
+
+void DecompressRecord(RecordCompression compression, const uint8_t* payload, size_t size, uint8_t* dst)
+{
+	size_t uncompressed_size = GetUncompressedSize(compression, payload, size);
+	const uint8_t* src = payload + sizeof(uint64_t);
+	size_t src_size = size - sizeof(uint64_t);
+
+	switch (compression)
+	{
+		case RecordLZ4:
+		{
+			if (uncompressed_size > LZ4_MAX_INPUT_SIZE || src_size > LZ4_MAX_INPUT_SIZE)
+				throw runtime_error("Corrupted compressed record, size %zd is too large for lz4", uncompressed_size);
+			int result = LZ4_decompress_safe((const char*)src, (char*)dst, int(src_size), int(uncompressed_size));
+			if (result < 0 || size_t(result) != uncompressed_size)
+				throw runtime_error("Corrupted compressed record, lz4 decompression failed");
+			break;
+		}
+		case RecordDeflate:
+		{
+			uLongf dst_size = uncompressed_size;
+			int result = uncompress(dst, &dst_size, src, src_size);
+			if (result != Z_OK || dst_size != uncompressed_size)
+				throw runtime_error("Corrupted compressed record, inflate failed");
+			break;
+		}
+		default:
+			throw runtime_error("Unknown record compression %d", int(compression));
+	}
+}
+
+std::vector<uint8_t> CompressRecord(RecordCompression compression, const uint8_t* data, size_t size)
+{
+	std::vector<uint8_t> payload;
+	uint64_t uncompressed_size = size;
+
+	switch (compression)
+	{
+		case RecordLZ4:
+		{
+			if (size > LZ4_MAX_INPUT_SIZE)
+				throw runtime_error("Record of size %zd is too large for lz4", size);
+			payload.resize(sizeof(uint64_t) + LZ4_compressBound(int(size)));
+			int result = LZ4_compress_default((const char*)data, (char*)payload.data() + sizeof(uint64_t), int(size),
+			                                  int(payload.size() - sizeof(uint64_t)));
+			if (result <= 0)
+				throw runtime_error("LZ4 compression failed");
+			payload.resize(sizeof(uint64_t) + result);
+			break;
+		}
+		case RecordDeflate:
+		{
+			uLongf compressed_size = compressBound(size);
+			payload.resize(sizeof(uint64_t) + compressed_size);
+			if (compress2(payload.data() + sizeof(uint64_t), &compressed_size, data, size, Z_DEFAULT_COMPRESSION) != Z_OK)
+				throw runtime_error("Deflate failed");
+			payload.resize(sizeof(uint64_t) + compressed_size);
+			break;
+		}
+		default:
+			throw runtime_error("Unknown record compression %d", int(compression));
+	}
+	memcpy(payload.data(), &uncompressed_size, sizeof(uint64_t));
+	return payload;
+}
@@ -0,0 +1,58 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+
+// Payloads of records can be compressed individually, unlike whole-file compression, such records can be
+// decompressed in parallel and in any order. Compression is flagged in the two top bits of the length field of the
+// record header. Compressed payload starts with uint64 size of the uncompressed data, followed by compressed data.
+// Crc32 of the record covers the payload as stored. Other tfrecord readers see a length of about 2^62 for such
+// records, so files with compressed records can only be read by this library.
+enum RecordCompression
+{
+	RecordUncompressed = 0,
+	RecordLZ4 = 1,
+	RecordDeflate = 2
+};
+
+enum
+{
+	RecordCompressionShift = 62
+};
+
+static const uint64_t kRecordLengthMask = (uint64_t(1) << RecordCompressionShift) - 1;
+
+inline RecordCompression GetRecordCompression(uint64_t length_field)
+{
+	return RecordCompression(length_field >> RecordCompressionShift);
+}
+
+inline uint64_t GetRecordLength(uint64_t length_field)
+{
+	return length_field & kRecordLengthMask;
+}
+
+// Size of the data, that compressed payload of `size` bytes holds. Throws if the stored size is more than the payload
+// can possibly expand to
+size_t GetUncompressedSize(RecordCompression compression, const uint8_t* payload, size_t size);
+
+// Decompresses payload to `dst`, which must hold GetUncompressedSize bytes
+void DecompressRecord(RecordCompression compression, const uint8_t* payload, size_t size, uint8_t* dst);
+
+// Returns payload to be stored, with the size prefix
+std::vector<uint8_t> CompressRecord(RecordCompression compression, const uint8_t* data, size_t size);
@@ -0,0 +1,179 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include "record_readers.h"
+#include "common.h"
+#include <vector>
+#include <string>
+#include <list>
+#include <mutex>
+#include <algorithm>
+
+
+// Random access to records of many tfrecord files by the global record number, i.e. number in the concatenation of
+// all files. Offsets of all records are kept in one table, `m_first_record` holds the global number of the first
+// record of each file. Only `max_open_files` readers are kept open, least recently used ones are closed.
+class HIDDEN RecordDataset
+{
+public:
+	RecordDataset(const RecordDataset&) = delete; // non construction-copyable
+	RecordDataset& operator=( const RecordDataset&) = delete; // non copyable
+
+	RecordDataset(const std::vector<std::string>& filenames, RecordReader::Compression compression, RecordReader::ReadMode mode,
+	              int max_open_files, int threads, bool save_index):
+		m_filenames(filenames), m_compression(compression), m_mode(mode), m_max_open_files(std::max(max_open_files, 1)),
+		m_save_index(save_index)
+	{
+		int count = int(m_filenames.size());
+		std::vector<std::vector<uint64_t> > offsets(count);
+		std::string error;
+		std::mutex error_mutex;
+
+		#pragma omp parallel for schedule(dynamic) num_threads(std::max(threads, 1))
+		for (int i = 0; i < count; ++i)
+		{
+			try
+			{
+				RecordReader reader(m_filenames[i], m_compression);
+				reader.LoadIndex(true, save_index);
+				offsets[i] = reader.index()->offsets;
+			}
+			catch (const std::exception& e)
+			{
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (error.empty())
+				{
+					error = e.what();
+				}
+			}
+		}
+		if (!error.empty())
+		{
+			throw runtime_error("%s", error.c_str());
+		}
+
+		m_first_record.resize(count + 1);
+		m_first_record[0] = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			m_first_record[i + 1] = m_first_record[i] + offsets[i].size();
+		}
+		m_offsets.reserve(m_first_record[count]);
+		for (int i = 0; i < count; ++i)
+		{
+			m_offsets.insert(m_offsets.end(), offsets[i].begin(), offsets[i].end());
+		}
+
+		m_readers.resize(count);
+		m_lru_position.resize(count, m_lru.end());
+	}
+
+	size_t size() const { return m_offsets.size(); }
+
+	int file_count() const { return int(m_filenames.size()); }
+
+	// Global number of the first record of `file`. Records of a file are numbered contiguously
+	size_t first_record(int file) const { return m_first_record[file]; }
+
+	// Number of the file that holds record `number`
+	int FileOf(size_t number) const
+	{
+		return int(std::upper_bound(m_first_record.begin(), m_first_record.end(), number) - m_first_record.begin()) - 1;
+	}
+
+	fsal::Status ReadRecord(size_t number, std::function<void*(size_t size)> alloc_func)
+	{
+		if (number >= size())
+			throw runtime_error("Record number %zd is out of range, dataset has %zd records", number, size());
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		int file = FileOf(number);
+		uint64_t offset = m_offsets[number];
+		return GetReader(file)->ReadRecord(offset, std::move(alloc_func));
+	}
+
+	// Reads many records. Records of the same file are read with one RecordReader::ReadRecords call.
+	// `alloc_func` is called with the position of the number in `numbers`.
+	void ReadRecords(const std::vector<size_t>& numbers, std::function<void*(size_t index, size_t size)> alloc_func)
+	{
+		std::vector<size_t> order(numbers.size());
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			if (numbers[i] >= size())
+				throw runtime_error("Record number %zd is out of range, dataset has %zd records", numbers[i], size());
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [&numbers](size_t a, size_t b) { return numbers[a] < numbers[b]; });
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t begin = 0;
+		while (begin < order.size())
+		{
+			int file = FileOf(numbers[order[begin]]);
+			size_t end = begin;
+			std::vector<uint64_t> offsets;
+			while (end < order.size() && numbers[order[end]] < m_first_record[file + 1])
+			{
+				offsets.push_back(m_offsets[numbers[order[end]]]);
+				++end;
+			}
+			GetReader(file)->ReadRecords(offsets, [&alloc_func, &order, begin](size_t i, size_t size)
+			{
+				return alloc_func(order[begin + i], size);
+			});
+			begin = end;
+		}
+	}
+
+private:
+	RecordReader* GetReader(int file)
+	{
+		if (m_readers[file])
+		{
+			m_lru.splice(m_lru.begin(), m_lru, m_lru_position[file]);
+			return m_readers[file].get();
+		}
+
+		if (int(m_lru.size()) >= m_max_open_files)
+		{
+			int oldest = m_lru.back();
+			m_readers[oldest].reset();
+			m_lru_position[oldest] = m_lru.end();
+			m_lru.pop_back();
+		}
+
+		m_readers[file].reset(new RecordReader(m_filenames[file], m_compression, m_mode));
+		// Compressed files need inflate checkpoints, otherwise every backward seek inflates the file from the start.
+		// They are loaded from the sidecar saved on construction, or built again if it was not saved.
+		m_readers[file]->LoadIndex(true, m_save_index);
+		m_lru.push_front(file);
+		m_lru_position[file] = m_lru.begin();
+		return m_readers[file].get();
+	}
+
+	std::vector<std::string> m_filenames;
+	RecordReader::Compression m_compression;
+	RecordReader::ReadMode m_mode;
+	int m_max_open_files;
+	bool m_save_index;
+
+	std::vector<uint64_t> m_offsets;
+	std::vector<size_t> m_first_record;
+
+	std::vector<std::unique_ptr<RecordReader> > m_readers;
+	std::list<int> m_lru;
+	std::vector<std::list<int>::iterator> m_lru_position;
+	std::mutex m_mutex;
+};
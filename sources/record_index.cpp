@@ -0,0 +1,182 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "record_index.h"
+#include <cstdio>
+#include <atomic>
+#include <random>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+
+static const uint32_t kIndexMagic = 0x49524244; // "DBRI"
+static const uint32_t kIndexVersion = 1;
+
+enum
+{
+	kHasHeaderCRCs = 1
+};
+
+#pragma pack(push,1)
+struct IndexFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t file_size;
+	uint64_t mtime;
+	uint64_t entries;
+	uint32_t flags;
+	uint32_t reserved;
+};
+#pragma pack(pop)
+
+
+bool GetFileStamp(const std::string& filename, uint64_t& file_size, uint64_t& mtime)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(filename.c_str(), &st) != 0)
+		return false;
+	file_size = st.st_size;
+	mtime = st.st_mtime;
+#else
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return false;
+	file_size = st.st_size;
+#if defined(__linux__)
+	mtime = uint64_t(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+	mtime = uint64_t(st.st_mtimespec.tv_sec) * 1000000000ull + st.st_mtimespec.tv_nsec;
+#else
+	mtime = st.st_mtime;
+#endif
+#endif
+	return true;
+}
+
+std::string TemporarySidecarPath(const std::string& filename)
+{
+	static std::atomic<uint64_t> counter(0);
+#ifdef _WIN32
+	uint64_t pid = _getpid();
+#else
+	uint64_t pid = getpid();
+#endif
+	// Process ids repeat across machines that share a file system, hence the random part
+	static const uint64_t random = (uint64_t(std::random_device{}()) << 32) ^ std::random_device{}();
+	return filename + ".tmp." + std::to_string(pid) + "." + std::to_string(random) + "." + std::to_string(counter++);
+}
+
+std::string RecordIndex::SidecarPath(const std::string& filename)
+{
+	return filename + ".index";
+}
+
+uint64_t RecordIndex::data_size() const
+{
+	uint64_t size = 0;
+	for (auto l: lengths)
+	{
+		size += l;
+	}
+	return size;
+}
+
+bool RecordIndex::Load(const std::string& filename, uint64_t file_size, uint64_t mtime)
+{
+	FILE* fp = std::fopen(filename.c_str(), "rb");
+	if (!fp)
+		return false;
+
+	IndexFileHeader header = { 0 };
+	bool ok = std::fread(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && header.magic == kIndexMagic && header.version == kIndexVersion;
+	ok = ok && header.file_size == file_size && header.mtime == mtime;
+
+	// Header alone does not prove that the rest of the file was written, entries must match the size of the file
+	uint64_t index_size = 0;
+	uint64_t index_mtime = 0;
+	ok = ok && GetFileStamp(filename, index_size, index_mtime);
+	if (ok)
+	{
+		uint64_t entry_size = 2 * sizeof(uint64_t) + ((header.flags & kHasHeaderCRCs) ? sizeof(uint32_t) : 0);
+		ok = index_size >= sizeof(header) && (index_size - sizeof(header)) % entry_size == 0 &&
+		     header.entries == (index_size - sizeof(header)) / entry_size;
+	}
+
+	if (ok)
+	{
+		size_t entries = header.entries;
+		offsets.resize(entries);
+		lengths.resize(entries);
+		header_crcs.resize((header.flags & kHasHeaderCRCs) ? entries : 0);
+
+		ok = std::fread(offsets.data(), sizeof(uint64_t), entries, fp) == entries;
+		ok = ok && std::fread(lengths.data(), sizeof(uint64_t), entries, fp) == entries;
+		ok = ok && std::fread(header_crcs.data(), sizeof(uint32_t), header_crcs.size(), fp) == header_crcs.size();
+	}
+	std::fclose(fp);
+
+	if (!ok)
+	{
+		offsets.clear();
+		lengths.clear();
+		header_crcs.clear();
+	}
+	return ok;
+}
+
+bool RecordIndex::Save(const std::string& filename, uint64_t file_size, uint64_t mtime) const
+{
+	// Write to a temporary file first, so that concurrent readers never observe a partially written index
+	std::string tmp_filename = TemporarySidecarPath(filename);
+	FILE* fp = std::fopen(tmp_filename.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	IndexFileHeader header = { 0 };
+	header.magic = kIndexMagic;
+	header.version = kIndexVersion;
+	header.file_size = file_size;
+	header.mtime = mtime;
+	header.entries = offsets.size();
+	header.flags = header_crcs.size() == offsets.size() ? kHasHeaderCRCs : 0;
+
+	size_t crcs_count = (header.flags & kHasHeaderCRCs) ? header_crcs.size() : 0;
+
+	bool ok = std::fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), fp) == offsets.size();
+	ok = ok && std::fwrite(lengths.data(), sizeof(uint64_t), lengths.size(), fp) == lengths.size();
+	ok = ok && std::fwrite(header_crcs.data(), sizeof(uint32_t), crcs_count, fp) == crcs_count;
+	ok = (std::fclose(fp) == 0) && ok;
+
+	if (ok)
+	{
+#ifdef _WIN32
+		std::remove(filename.c_str());
+#endif
+		ok = std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+	}
+	if (!ok)
+	{
+		std::remove(tmp_filename.c_str());
+	}
+	return ok;
+}
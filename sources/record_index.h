@@ -0,0 +1,46 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+
+// Offsets and lengths of all records of a tfrecord file.
+// Persisted next to the shard as `<shard>.index` and validated against size and modification time of the shard.
+// For compressed shards offsets are given in the uncompressed stream.
+struct RecordIndex
+{
+	std::vector<uint64_t> offsets;
+	std::vector<uint64_t> lengths;
+	std::vector<uint32_t> header_crcs; // masked crc32c of the length field, as stored in the record header. Can be empty
+
+	size_t size() const { return offsets.size(); }
+
+	uint64_t data_size() const;
+
+	bool Load(const std::string& filename, uint64_t file_size, uint64_t mtime);
+
+	bool Save(const std::string& filename, uint64_t file_size, uint64_t mtime) const;
+
+	static std::string SidecarPath(const std::string& filename);
+};
+
+// Size and modification time used to validate sidecar files. Returns false if the file can not be accessed.
+bool GetFileStamp(const std::string& filename, uint64_t& file_size, uint64_t& mtime);
+
+// Name of a temporary file, which a sidecar is written to before it is renamed. Names are unique per process, host and
+// call, so that workers that build the same sidecar at once do not write to or remove each other's files.
+std::string TemporarySidecarPath(const std::string& filename);
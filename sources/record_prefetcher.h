@@ -0,0 +1,257 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include "record_readers.h"
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+#include "common.h"
+
+
+// Reads records of a sequence of files on background threads. Each thread reads one file at a time, so up to
+// `threads` files are read concurrently, while records are returned in the order of files. Each file being read
+// buffers up to `depth` records. Errors of reader threads are rethrown by Next when the consumer reaches them.
+//
+// With `cycle_length` > 1 records are interleaved the way tf.data interleave does: `cycle_length` files are open at
+// once and `block_length` records are taken from each in turn. A file that is read to the end is replaced by the next
+// one in the same slot. Every open file has its own thread, so the order does not depend on the number of threads.
+class RecordPrefetcher
+{
+public:
+	RecordPrefetcher(const RecordPrefetcher&) = delete; // non construction-copyable
+	RecordPrefetcher& operator=( const RecordPrefetcher&) = delete; // non copyable
+
+	typedef std::function<RecordReader*(size_t file)> OpenFunc;
+
+	RecordPrefetcher(size_t files, OpenFunc open, int threads, size_t depth, int cycle_length = 1, size_t block_length = 0):
+		m_files(files), m_open(std::move(open)), m_depth(std::max(depth, size_t(1))), m_block_length(block_length)
+	{
+		cycle_length = std::max(cycle_length, 1);
+		m_window = std::max(threads, cycle_length);
+		for (size_t file = 0; file < std::min(size_t(cycle_length), m_files); ++file)
+		{
+			m_cycle.push_back(file);
+		}
+		m_opened = m_cycle.size();
+
+		for (int i = 0; i < m_window; ++i)
+		{
+			m_workers.emplace_back(&RecordPrefetcher::Worker, this);
+		}
+	}
+
+	~RecordPrefetcher()
+	{
+		Stop();
+		for (auto& worker: m_workers)
+		{
+			worker.join();
+		}
+	}
+
+	// Blocks until the next record is available. Returns false at the end of the last file, or once stopped.
+	bool Next(std::string& record)
+	{
+		while (NextRecord(record))
+		{
+			if (m_record_number++ % m_num_shards == m_shard_index)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Makes Next return only records whose number in the whole sequence equals `shard_index` modulo `num_shards`.
+	// Files are not sharded by readers, since the number of records before a file is not known when it is opened,
+	// so records of other shards are read and dropped. Must be called before Next.
+	void SetSharding(size_t shard_index, size_t num_shards)
+	{
+		if (num_shards == 0 || shard_index >= num_shards)
+			throw runtime_error("Shard index %zd is out of range, number of shards is %zd", shard_index, num_shards);
+		m_shard_index = shard_index;
+		m_num_shards = num_shards;
+	}
+
+	// Makes waiting and subsequent calls of Next return false. Reads in progress are finished by the destructor.
+	void Stop()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+		m_ready_cv.notify_all();
+		m_space_cv.notify_all();
+	}
+
+private:
+	struct FileQueue
+	{
+		std::deque<std::string> records;
+		bool done = false;
+		std::string error;
+	};
+
+	bool NextRecord(std::string& record)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_ready_cv.wait(lock, [this]
+			{
+				if (m_stop || m_cycle.empty())
+					return true;
+				auto it = m_queues.find(m_cycle[m_slot]);
+				return it != m_queues.end() && (!it->second.records.empty() || it->second.done);
+			});
+			if (m_stop || m_cycle.empty())
+			{
+				return false;
+			}
+
+			FileQueue& queue = m_queues[m_cycle[m_slot]];
+			if (!queue.records.empty())
+			{
+				record = std::move(queue.records.front());
+				queue.records.pop_front();
+				if (m_block_length != 0 && ++m_taken >= m_block_length)
+				{
+					NextSlot();
+				}
+				m_space_cv.notify_all();
+				return true;
+			}
+			if (!queue.error.empty())
+			{
+				throw runtime_error("%s", queue.error.c_str());
+			}
+
+			// File is read to the end, which lets one more file start reading
+			m_queues.erase(m_cycle[m_slot]);
+			++m_retired;
+			if (m_opened < m_files)
+			{
+				m_cycle[m_slot] = m_opened++;
+				NextSlot();
+			}
+			else
+			{
+				m_cycle.erase(m_cycle.begin() + m_slot);
+				m_slot = m_cycle.empty() ? 0 : m_slot % m_cycle.size();
+				m_taken = 0;
+			}
+			m_space_cv.notify_all();
+		}
+	}
+
+	void NextSlot()
+	{
+		m_slot = (m_slot + 1) % m_cycle.size();
+		m_taken = 0;
+	}
+
+	void Worker()
+	{
+		while (true)
+		{
+			size_t file = 0;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_space_cv.wait(lock, [this]
+				{
+					return m_stop || m_next_file >= m_files || m_next_file < m_retired + m_window;
+				});
+				if (m_stop || m_next_file >= m_files)
+				{
+					return;
+				}
+				file = m_next_file++;
+				m_queues[file];
+			}
+
+			std::string error;
+			try
+			{
+				std::unique_ptr<RecordReader> rr(m_open(file));
+				while (true)
+				{
+					std::string record;
+					size_t record_size = 0;
+					auto status = rr->GetNext([&record, &record_size](size_t size)
+					{
+						record_size = size;
+						record.resize(size + sizeof(uint32_t));
+						return &record[0];
+					});
+					if (status.is_eof())
+					{
+						break;
+					}
+					if (!status.ok())
+					{
+						throw runtime_error("Error while iterating RecordReader at offset: %zd", rr->offset());
+					}
+					record.resize(record_size);
+
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_space_cv.wait(lock, [this, file] { return m_stop || m_queues[file].records.size() < m_depth; });
+					if (m_stop)
+					{
+						return;
+					}
+					m_queues[file].records.push_back(std::move(record));
+					m_ready_cv.notify_all();
+				}
+			}
+			catch (const std::exception& e)
+			{
+				error = e.what();
+			}
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queues[file].done = true;
+			m_queues[file].error = std::move(error);
+			m_ready_cv.notify_all();
+		}
+	}
+
+	size_t m_files;
+	OpenFunc m_open;
+	int m_window;
+	size_t m_depth;
+	size_t m_block_length;
+
+	std::mutex m_mutex;
+	std::condition_variable m_ready_cv;  // consumer waits for records
+	std::condition_variable m_space_cv;  // workers wait for space in their queue, or for the next file
+	std::map<size_t, FileQueue> m_queues;
+	size_t m_next_file = 0;
+	std::vector<size_t> m_cycle; // files open for the consumer, one per slot
+	size_t m_slot = 0;           // slot records are currently taken from
+	size_t m_taken = 0;          // records taken from the current slot in the current block
+	size_t m_opened = 0;         // files that were given a slot
+	size_t m_retired = 0;        // files read to the end
+	bool m_stop = false;
+
+	// Sharding, used by the consumer thread only
+	size_t m_shard_index = 0;
+	size_t m_num_shards = 1;
+	size_t m_record_number = 0;  // records returned by NextRecord
+	std::vector<std::thread> m_workers;
+};
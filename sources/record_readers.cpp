@@ -16,49 +16,369 @@
 #include <crc32c/crc32c.h>
 #include <limits.h>
 #include <cassert>
+#include <algorithm>
+#include <vector>
+#include <mutex>
 #include "common.h"
 #include "zlib_file.h"
+#include "libdeflate_file.h"
+#include "lz4_file.h"
+#include "read_ahead_file.h"
+#include "mmap_file.h"
+#include "async_file.h"
+#include "posix_file.h"
 
 
-static const uint32_t kMaskDelta = 0xa282ead8ul;
+// crc32c_combine computes crc of concatenation of two blocks given their crcs. Same approach as in zlib's
+// crc32_combine, operator for appending zeros is built in GF(2) from the (reflected) Castagnoli polynomial.
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+	while (vec)
+	{
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+	return sum;
+}
 
-inline uint32_t Mask(uint32_t crc)
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat)
 {
-	return ((crc >> 15) | (crc << 17)) + kMaskDelta;
+	for (int n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+static uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+	if (len2 == 0)
+		return crc1;
+
+	uint32_t even[32];
+	uint32_t odd[32];
+
+	odd[0] = 0x82f63b78ul;
+	uint32_t row = 1;
+	for (int n = 1; n < 32; n++)
+	{
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	gf2_matrix_square(even, odd); // two zero bits
+	gf2_matrix_square(odd, even); // four zero bits
+
+	do
+	{
+		gf2_matrix_square(even, odd);
+		if (len2 & 1)
+			crc1 = gf2_matrix_times(even, crc1);
+		len2 >>= 1;
+		if (len2 == 0)
+			break;
+
+		gf2_matrix_square(odd, even);
+		if (len2 & 1)
+			crc1 = gf2_matrix_times(odd, crc1);
+		len2 >>= 1;
+	}
+	while (len2 != 0);
+
+	return crc1 ^ crc2;
 }
 
-inline uint32_t Unmask(uint32_t masked_crc)
+enum
+{
+	ParallelCRCThreshold = 4 * 1024 * 1024,
+	ParallelCRCChunk = 1024 * 1024
+};
+
+// Large payloads are checksummed by chunks in parallel
+static uint32_t crc32c_parallel(const uint8_t* data, size_t size)
 {
-	uint32_t rot = masked_crc - kMaskDelta;
-	return ((rot >> 17) | (rot << 15));
+	if (size < ParallelCRCThreshold)
+		return crc32c_value(data, size);
+
+	int chunks = int((size + ParallelCRCChunk - 1) / ParallelCRCChunk);
+	std::vector<uint32_t> crcs(chunks);
+
+	#pragma omp parallel for
+	for (int i = 0; i < chunks; ++i)
+	{
+		size_t begin = size_t(i) * ParallelCRCChunk;
+		crcs[i] = crc32c_value(data + begin, std::min(size_t(ParallelCRCChunk), size - begin));
+	}
+
+	uint32_t crc = crcs[0];
+	for (int i = 1; i < chunks; ++i)
+	{
+		size_t begin = size_t(i) * ParallelCRCChunk;
+		crc = crc32c_combine(crc, crcs[i], std::min(size_t(ParallelCRCChunk), size - begin));
+	}
+	return crc;
 }
 
-RecordReader::RecordReader(fsal::File file, Compression compression): m_offset(0), m_file(std::move(file))
+RecordReader::RecordReader(fsal::File file, Compression compression, ReadMode mode, size_t block_size,
+                           int io_depth, std::shared_ptr<IOEngine> engine, bool advise, InflateBackend inflate_backend): m_offset(0), m_file(std::move(file))
 {
-	// Does not handle compression yet
 	if (!m_file)
 		throw runtime_error("Can't create RecordReader. Given file is None");
 
-	if (compression == GZIP)
-		m_file = fsal::File(new fsal::ZlibFile(m_file.GetInterface(), MAX_WBITS + 16));
-	else if (compression == ZLIB)
-		m_file = fsal::File(new fsal::ZlibFile(m_file.GetInterface(), MAX_WBITS));
+	Init(compression, mode, block_size, io_depth, std::move(engine), advise, inflate_backend);
 }
 
-RecordReader::RecordReader(const std::string& file, Compression compression): m_offset(0)
+RecordReader::RecordReader(const std::string& file, Compression compression, ReadMode mode, size_t block_size,
+                           int io_depth, std::shared_ptr<IOEngine> engine, bool advise, InflateBackend inflate_backend): m_offset(0)
 {
 	fsal::FileSystem fs;
 	m_file = fs.Open(file);
 	if (!m_file)
 		throw runtime_error("Can't create RecordReader. Can't find file: %s", file.c_str());
 
-	if (compression == GZIP)
-		m_file = fsal::File(new fsal::ZlibFile(m_file.GetInterface(), MAX_WBITS + 16));
+	Init(compression, mode, block_size, io_depth, std::move(engine), advise, inflate_backend);
+}
+
+RecordReader::~RecordReader()
+{
+	// Worker of the background inflate must be stopped before the kernel hints it uses are destroyed
+	m_file = fsal::File();
+	m_read_ahead_file.reset();
+}
+
+void RecordReader::Init(Compression compression, ReadMode mode, size_t block_size, int io_depth, std::shared_ptr<IOEngine> engine, bool advise,
+                        InflateBackend inflate_backend)
+{
+	int fd = -1;
+
+	m_mode = mode;
+	m_compression = compression;
+	m_path = m_file.GetPath().string();
+
+	if (mode == MMap)
+	{
+		if (compression != None)
+			throw runtime_error("Can't create RecordReader. MMap mode does not support compressed records. Record file: %s", m_file.GetPath().c_str());
+
+		// Files that already live in memory (e.g. opened from an archive) are used as is
+		const fsal::File& file = m_file;
+		if (file.GetDataPointer() == nullptr)
+		{
+			auto mapped = std::make_shared<fsal::MMapFile>(m_file.GetPath());
+#ifndef _WIN32
+			fd = mapped->fd();
+#endif
+			m_file = fsal::File(std::static_pointer_cast<fsal::FileInterface>(mapped));
+		}
+		m_data = static_cast<const fsal::File&>(m_file).GetDataPointer();
+		m_data_size = m_file.GetSize();
+	}
+
+	if (mode == Buffered)
+	{
+		if (block_size < sizeof(RecordHeader))
+			throw runtime_error("Can't create RecordReader. Block size %zd is too small", block_size);
+		m_block_size = block_size;
+		m_block.reset(new uint8_t[m_block_size]);
+	}
+
+	if (mode == Async)
+	{
+		if (block_size < sizeof(RecordHeader))
+			throw runtime_error("Can't create RecordReader. Block size %zd is too small", block_size);
+		if (!engine)
+			engine = IOEngine::Create(io_depth);
+		m_async_file = std::make_shared<fsal::AsyncReadFile>(m_file.GetPath(), std::move(engine), block_size, io_depth);
+		m_file = fsal::File(std::static_pointer_cast<fsal::FileInterface>(m_async_file));
+		fd = m_async_file->fd();
+	}
+
+	if (mode == Direct)
+	{
+#ifdef _WIN32
+		throw runtime_error("Direct reading is not supported on this platform");
+#else
+		m_file = fsal::File(new fsal::DirectFile(m_file.GetPath(), block_size));
+#endif
+	}
+
+#ifndef _WIN32
+	if (advise && (mode == Stream || mode == Buffered))
+	{
+		// Hints need a file descriptor, so the file is reopened with pread-based file. Files that do not exist
+		// on disk (e.g. opened from an archive) are read without hints.
+		const fsal::File& file = m_file;
+		if (file.GetDataPointer() == nullptr)
+		{
+			try
+			{
+				auto posix_file = std::make_shared<fsal::PosixFile>(m_file.GetPath());
+				fd = posix_file->fd();
+				m_file = fsal::File(std::static_pointer_cast<fsal::FileInterface>(posix_file));
+			}
+			catch (const runtime_error&)
+			{
+			}
+		}
+	}
+#endif
+
+	if (advise && fd >= 0)
+	{
+		m_source = m_file.GetInterface();
+		m_advice.reset(new ReadAdvice(fd, m_data, m_source->GetSize()));
+	}
+
+	if ((compression == GZIP || compression == ZLIB) && inflate_backend == LibdeflateInflate)
+	{
+		auto format = compression == GZIP ? fsal::LibdeflateFile::Gzip : fsal::LibdeflateFile::Zlib;
+		m_file = fsal::File(new fsal::LibdeflateFile(m_file.GetInterface(), format));
+	}
+	else if (compression == GZIP)
+		m_zlib_file = std::make_shared<fsal::ZlibFile>(m_file.GetInterface(), MAX_WBITS + 16);
 	else if (compression == ZLIB)
-		m_file = fsal::File(new fsal::ZlibFile(m_file.GetInterface(), MAX_WBITS));
+		m_zlib_file = std::make_shared<fsal::ZlibFile>(m_file.GetInterface(), MAX_WBITS);
+	else if (compression == LZ4)
+		m_file = fsal::File(new fsal::Lz4File(m_file.GetInterface()));
+
+	if (m_zlib_file)
+		m_file = fsal::File(std::static_pointer_cast<fsal::FileInterface>(m_zlib_file));
 }
 
-fsal::Status RecordReader::ReadChecksummed(uint64_t offset, size_t size, uint8_t* dst)
+void RecordReader::Advise(uint64_t offset)
+{
+	if (m_advice && !m_read_ahead_file)
+	{
+		// Compressed records are advised by the position in the compressed file
+		m_advice->Consumed(m_mode == MMap ? offset : m_source->GetPosition());
+	}
+}
+
+void RecordReader::StartPrefetch()
+{
+	if (m_async_file)
+		m_async_file->Prefetch();
+}
+
+bool RecordReader::PrefetchExhausted() const
+{
+	if (m_read_ahead_file)
+		return m_read_ahead_file->exhausted();
+	return !m_async_file || m_async_file->PrefetchExhausted();
+}
+
+void RecordReader::StartBackgroundInflate(size_t block_size, int depth)
+{
+	if (m_compression == None || m_read_ahead_file)
+		return;
+
+	// Kernel hints follow the compressed file, which is now read by the worker
+	std::function<void()> on_read;
+	if (m_advice)
+	{
+		on_read = [this]() { m_advice->Consumed(m_source->GetPosition()); };
+	}
+	m_read_ahead_file = std::make_shared<fsal::ReadAheadFile>(m_file.GetInterface(), block_size, depth, std::move(on_read));
+	m_file = fsal::File(std::static_pointer_cast<fsal::FileInterface>(m_read_ahead_file));
+}
+
+void RecordReader::SetParallelInflate(int threads)
+{
+	if (m_zlib_file)
+		m_zlib_file->SetParallelInflate(threads);
+}
+
+fsal::Status RecordReader::ReadAt(uint64_t offset, uint8_t* dst, size_t size, size_t* bytes_read)
+{
+	if (m_mode == Buffered)
+	{
+		return ReadBuffered(offset, dst, size, bytes_read);
+	}
+
+	// Seeking is skipped for sequential reads, it is not free for compressed files
+	if (m_file.Tell() != offset)
+	{
+		m_file.Seek(offset);
+	}
+	return m_file.Read(dst, size, bytes_read);
+}
+
+fsal::Status RecordReader::ReadBuffered(uint64_t offset, uint8_t* dst, size_t size, size_t* bytes_read)
+{
+	*bytes_read = 0;
+	while (size > 0)
+	{
+		if (offset >= m_block_offset && offset < m_block_offset + m_block_fill)
+		{
+			size_t will_copy = std::min(size_t(m_block_offset + m_block_fill - offset), size);
+			memcpy(dst, m_block.get() + (offset - m_block_offset), will_copy);
+			dst += will_copy;
+			size -= will_copy;
+			offset += will_copy;
+			*bytes_read += will_copy;
+			continue;
+		}
+
+		// Blocks are aligned for uncompressed files. Compressed files are read strictly forward,
+		// since seeking back is expensive.
+		uint64_t block_start = m_compression == None ? offset - offset % m_block_size : offset;
+
+		if (m_file.Tell() != block_start)
+		{
+			m_file.Seek(block_start);
+		}
+
+		// Reads that are larger than the block go straight to the destination
+		if (size >= m_block_size && block_start == offset)
+		{
+			size_t result = 0;
+			auto status = m_file.Read(dst, size, &result);
+			*bytes_read += result;
+			if (!status.ok())
+				return status;
+			return result == size ? fsal::Status(fsal::Status::kOk) : fsal::Status(fsal::Status::kEOF);
+		}
+
+		size_t result = 0;
+		auto status = m_file.Read(m_block.get(), m_block_size, &result);
+		m_block_offset = block_start;
+		m_block_fill = result;
+
+		if (!status.ok())
+			return status;
+		if (offset >= m_block_offset + m_block_fill)
+			return fsal::Status::kEOF;
+	}
+	return fsal::Status::kOk;
+}
+
+void RecordReader::SetVerification(Verification verification, int sample_rate)
+{
+	if (sample_rate < 1)
+		throw runtime_error("Sample rate must be positive, got %d", sample_rate);
+	m_verification = verification;
+	m_sample_rate = sample_rate;
+}
+
+bool RecordReader::VerifyHeader() const
+{
+	return m_verification != VerifyNone;
+}
+
+bool RecordReader::VerifyPayload()
+{
+	switch (m_verification)
+	{
+		case VerifyFull:
+			return true;
+		case VerifySampled:
+			return (m_payload_counter++ % m_sample_rate) == 0;
+		default:
+			return false;
+	}
+}
+
+fsal::Status RecordReader::ReadChecksummed(uint64_t offset, size_t size, uint8_t* dst, bool verify)
 {
 	if (size >= SIZE_MAX - sizeof(uint32_t))
 	{
@@ -68,7 +388,7 @@ fsal::Status RecordReader::ReadChecksummed(uint64_t offset, size_t size, uint8_t
 	const size_t expected = size + sizeof(uint32_t);    // reading data together with crc32.
 	                                                    // Preallocated buffer has sizeof(uint32) padding
 	size_t result = 0;
-	auto read_result = m_file.Read(dst, expected, &result);
+	auto read_result = ReadAt(offset, dst, expected, &result);
 
 	if (!read_result.ok() || read_result.is_eof())
 	{
@@ -83,60 +403,396 @@ fsal::Status RecordReader::ReadChecksummed(uint64_t offset, size_t size, uint8_t
 	const uint32_t masked_crc = *(uint32_t*)(dst + size);
 	*(uint32_t*)(dst + size) = 0;
 
-	if (Unmask(masked_crc) != crc32c_value(dst, size))
+	if (verify && Unmask(masked_crc) != crc32c_parallel(dst, size))
 	{
 		throw runtime_error("Corrupted record, CRC32 didn't match. Error reading record at offset %zd. Record file: %s", offset, m_file.GetPath().c_str());
 	}
 	return true;
 }
 
-fsal::Status RecordReader::ReadRecord(uint64_t& offset, fsal::MemRefFile* mem_file)
+fsal::Status RecordReader::ReadRawView(uint64_t& offset, const uint8_t*& data, size_t& size)
 {
-	m_file.Seek(offset);
+	if (m_mode != MMap)
+		throw runtime_error("Record views are only available in MMap mode. Record file: %s", m_file.GetPath().c_str());
+
+	if (offset == m_data_size)
+	{
+		return fsal::Status::kEOF;
+	}
+
+	if (offset > m_data_size || m_data_size - offset < sizeof(RecordHeader))
+	{
+		throw runtime_error("Unexpected EOF. Corrupted record at offset %zd. Record file: %s", offset, m_file.GetPath().c_str());
+	}
 
 	RecordHeader header = { 0 };
-	fsal::Status r = ReadChecksummed(offset, sizeof(RecordHeader::length), (uint8_t*)&header);
-	if (!r.ok() || r.is_eof())
+	memcpy(&header, m_data + offset, sizeof(RecordHeader));
+
+	if (VerifyHeader() && Unmask(header.crc_of_length) != crc32c_value(m_data + offset, sizeof(RecordHeader::length)))
 	{
-		return r;
+		throw runtime_error("Corrupted record, CRC32 didn't match. Error reading record at offset %zd. Record file: %s", offset, m_file.GetPath().c_str());
 	}
 
-	mem_file->Resize(header.length + sizeof(uint32_t));
-	ReadChecksummed(offset + sizeof(RecordHeader), header.length, mem_file->GetDataPointer());
+	const uint64_t length = GetRecordLength(header.length);
+	const uint64_t payload_offset = offset + sizeof(RecordHeader);
+	if (m_data_size - payload_offset < sizeof(uint32_t) || m_data_size - payload_offset - sizeof(uint32_t) < length)
+	{
+		throw runtime_error("Unexpected EOF. Corrupted record at offset %zd. Record file: %s", payload_offset, m_file.GetPath().c_str());
+	}
+
+	const uint8_t* payload = m_data + payload_offset;
+	uint32_t masked_crc = 0;
+	memcpy(&masked_crc, payload + length, sizeof(uint32_t));
 
-	offset += sizeof(RecordHeader) + header.length + sizeof(uint32_t);
-	assert(offset == m_file.Tell());
+	if (VerifyPayload() && Unmask(masked_crc) != crc32c_parallel(payload, length))
+	{
+		throw runtime_error("Corrupted record, CRC32 didn't match. Error reading record at offset %zd. Record file: %s", payload_offset, m_file.GetPath().c_str());
+	}
+
+	data = payload;
+	size = length;
+	m_record_compression = GetRecordCompression(header.length);
+	offset = payload_offset + length + sizeof(uint32_t);
+	Advise(offset);
 	return true;
 }
 
+fsal::Status RecordReader::ReadRecordView(uint64_t& offset, const uint8_t*& data, size_t& size)
+{
+	uint64_t record_offset = offset;
+	fsal::Status r = ReadRawView(offset, data, size);
+	if (r.ok() && !r.is_eof() && m_record_compression != RecordUncompressed && m_decompress_records)
+	{
+		offset = record_offset;
+		throw runtime_error("Record at offset %zd is compressed, it can not be read as a view. Record file: %s", record_offset, m_file.GetPath().c_str());
+	}
+	return r;
+}
+
+void RecordReader::DecompressPayload(uint64_t offset, const uint8_t* payload, size_t size, const std::function<void*(size_t size)>& alloc_func)
+{
+	try
+	{
+		size_t uncompressed_size = GetUncompressedSize(m_record_compression, payload, size);
+		auto* data = (uint8_t*)alloc_func(uncompressed_size);
+		DecompressRecord(m_record_compression, payload, size, data);
+		memset(data + uncompressed_size, 0, sizeof(uint32_t));
+	}
+	catch (const runtime_error& e)
+	{
+		throw runtime_error("%s. Error reading record at offset %zd. Record file: %s", e.what(), offset, m_file.GetPath().c_str());
+	}
+}
+
+fsal::Status RecordReader::ReadRecord(uint64_t& offset, fsal::MemRefFile* mem_file)
+{
+	return ReadRecord(offset, [mem_file](size_t size)
+	{
+		mem_file->Resize(size + sizeof(uint32_t));
+		return (void*)mem_file->GetDataPointer();
+	});
+}
+
 fsal::Status RecordReader::ReadRecord(uint64_t& offset, std::function<void*(size_t size)> alloc_func)
 {
-	m_file.Seek(offset);
+	if (m_mode == MMap)
+	{
+		const uint64_t record_offset = offset;
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+		fsal::Status r = ReadRawView(offset, data, size);
+		if (r.ok() && !r.is_eof())
+		{
+			if (m_record_compression != RecordUncompressed && m_decompress_records)
+				DecompressPayload(record_offset, data, size, alloc_func);
+			else
+				memcpy(alloc_func(size), data, size);
+		}
+		return r;
+	}
 
 	RecordHeader header = { 0 };
-	fsal::Status r = ReadChecksummed(offset, sizeof(RecordHeader::length), (uint8_t*)&header);
+	fsal::Status r = ReadChecksummed(offset, sizeof(RecordHeader::length), (uint8_t*)&header, VerifyHeader());
 	if (!r.ok() || r.is_eof())
 	{
 		return r;
 	}
 
-	auto* data = (uint8_t*)alloc_func(header.length);
-	ReadChecksummed(offset + sizeof(RecordHeader), header.length, data);
+	const uint64_t length = GetRecordLength(header.length);
+	m_record_compression = GetRecordCompression(header.length);
+	if (m_record_compression != RecordUncompressed && m_decompress_records)
+	{
+		// Compressed payload is verified as stored, and then decompressed to the destination
+		m_scratch.resize(length + sizeof(uint32_t));
+		ReadChecksummed(offset + sizeof(RecordHeader), length, m_scratch.data(), VerifyPayload());
+		DecompressPayload(offset, m_scratch.data(), length, alloc_func);
+	}
+	else
+	{
+		auto* data = (uint8_t*)alloc_func(length);
+		ReadChecksummed(offset + sizeof(RecordHeader), length, data, VerifyPayload());
+	}
+
+	offset += sizeof(RecordHeader) + length + sizeof(uint32_t);
+	Advise(offset);
+	return true;
+}
+
+enum
+{
+	CoalesceGap = 64 * 1024,
+	CoalesceReadAhead = 64 * 1024
+};
+
+void RecordReader::ReadRecords(const std::vector<uint64_t>& offsets, std::function<void*(size_t index, size_t size)> alloc_func)
+{
+	std::vector<size_t> order(offsets.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&offsets](size_t a, size_t b) { return offsets[a] < offsets[b]; });
+
+	// Compressed payloads are decompressed after all records are read, in parallel. Destinations are allocated
+	// beforehand, since `alloc_func` is not required to be thread-safe.
+	std::vector<PendingRecord> pending;
+	auto store = [&](size_t i, uint64_t offset, const uint8_t* payload, size_t size, bool copy)
+	{
+		if (m_record_compression == RecordUncompressed || !m_decompress_records)
+		{
+			memcpy(alloc_func(i, size), payload, size);
+			return;
+		}
+		PendingRecord record;
+		record.compression = m_record_compression;
+		record.offset = offset;
+		if (copy)
+		{
+			record.copy.assign(payload, payload + size);
+		}
+		else
+		{
+			record.payload = payload;
+			record.size = size;
+		}
+		record.uncompressed_size = GetUncompressedSize(record.compression, payload, size);
+		record.dst = (uint8_t*)alloc_func(i, record.uncompressed_size);
+		pending.push_back(std::move(record));
+	};
+
+	if (m_mode == MMap)
+	{
+		for (size_t i: order)
+		{
+			uint64_t offset = offsets[i];
+			const uint8_t* data = nullptr;
+			size_t size = 0;
+			auto status = ReadRawView(offset, data, size);
+			if (status.is_eof())
+				throw runtime_error("Unexpected EOF. Corrupted record at offset %zd. Record file: %s", offsets[i], m_file.GetPath().c_str());
+			store(i, offsets[i], data, size, false);
+		}
+		DecompressPending(pending);
+		return;
+	}
+
+	// Holds [span_begin, span_begin + span.size() - skip) range of the file, starting at span[skip]. Consumed bytes
+	// are only dropped before the span is extended, so moving the rest is amortized by the read
+	std::vector<uint8_t> span;
+	size_t skip = 0;
+	uint64_t span_begin = 0;
+
+	// Returns pointer to [begin, end) range of the file, or nullptr if the file ends before `end`. Ranges that start
+	// shortly after the span extend it with a sequential read, instead of seeking and starting a new read.
+	auto fetch = [&](uint64_t begin, uint64_t end) -> const uint8_t*
+	{
+		uint64_t span_end = span_begin + span.size() - skip;
+		if (span_end == span_begin || begin < span_begin || begin > span_end + CoalesceGap)
+		{
+			span.clear();
+			skip = 0;
+			span_begin = begin;
+			span_end = begin;
+		}
+		else
+		{
+			size_t consumed = std::min(begin, span_end) - span_begin;
+			skip += consumed;
+			span_begin += consumed;
+		}
+
+		if (end > span_end)
+		{
+			span.erase(span.begin(), span.begin() + skip);
+			skip = 0;
+
+			uint64_t read_end = std::max(end, span_end + CoalesceReadAhead);
+			size_t filled = span.size();
+			span.resize(read_end - span_begin);
+			size_t result = 0;
+			auto status = ReadAt(span_end, span.data() + filled, read_end - span_end, &result);
+			if (!status.ok())
+			{
+				throw runtime_error("Error reading %zd bytes at offset %zd. Record file: %s", size_t(read_end - span_end), size_t(span_end), m_file.GetPath().c_str());
+			}
+			span.resize(filled + result);
+			if (span_begin + span.size() < end)
+				return nullptr;
+		}
+		return span.data() + skip + (begin - span_begin);
+	};
+
+	for (size_t i: order)
+	{
+		const uint64_t offset = offsets[i];
+		const uint8_t* data = fetch(offset, offset + sizeof(RecordHeader));
+		if (data == nullptr)
+		{
+			throw runtime_error("Unexpected EOF. Corrupted record at offset %zd. Record file: %s", offset, m_file.GetPath().c_str());
+		}
+
+		RecordHeader header = { 0 };
+		memcpy(&header, data, sizeof(RecordHeader));
+
+		if (VerifyHeader() && Unmask(header.crc_of_length) != crc32c_value(data, sizeof(RecordHeader::length)))
+		{
+			throw runtime_error("Corrupted record, CRC32 didn't match. Error reading record at offset %zd. Record file: %s", offset, m_file.GetPath().c_str());
+		}
+		const uint64_t length = GetRecordLength(header.length);
+		if (length >= SIZE_MAX - sizeof(uint32_t))
+		{
+			throw runtime_error("Record size too large %zd. Record file: %s", size_t(length), m_file.GetPath().c_str());
+		}
+
+		const uint64_t payload_offset = offset + sizeof(RecordHeader);
+		data = fetch(payload_offset, payload_offset + length + sizeof(uint32_t));
+		if (data == nullptr)
+		{
+			throw runtime_error("Unexpected EOF. Corrupted record at offset %zd. Record file: %s", payload_offset, m_file.GetPath().c_str());
+		}
+
+		uint32_t masked_crc = 0;
+		memcpy(&masked_crc, data + length, sizeof(uint32_t));
+
+		if (VerifyPayload() && Unmask(masked_crc) != crc32c_parallel(data, length))
+		{
+			throw runtime_error("Corrupted record, CRC32 didn't match. Error reading record at offset %zd. Record file: %s", payload_offset, m_file.GetPath().c_str());
+		}
+		m_record_compression = GetRecordCompression(header.length);
+
+		// Span is reused by the following reads, so compressed payloads are copied out of it
+		store(i, offset, data, length, true);
+	}
+	DecompressPending(pending);
+}
+
+void RecordReader::DecompressPending(std::vector<PendingRecord>& pending)
+{
+	std::string error;
+	std::mutex error_mutex;
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < int(pending.size()); ++i)
+	{
+		PendingRecord& record = pending[i];
+		const uint8_t* payload = record.copy.empty() ? record.payload : record.copy.data();
+		size_t size = record.copy.empty() ? record.size : record.copy.size();
+		try
+		{
+			DecompressRecord(record.compression, payload, size, record.dst);
+			memset(record.dst + record.uncompressed_size, 0, sizeof(uint32_t));
+		}
+		catch (const std::exception& e)
+		{
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (error.empty())
+			{
+				error = string_format("%s. Error reading record at offset %zd. Record file: %s", e.what(), size_t(record.offset), m_path.c_str());
+			}
+		}
+	}
+	if (!error.empty())
+	{
+		throw runtime_error("%s", error.c_str());
+	}
+}
+
+void RecordReader::SetSharding(size_t shard_index, size_t num_shards, size_t first_record)
+{
+	if (num_shards == 0 || shard_index >= num_shards)
+		throw runtime_error("Shard index %zd is out of range, number of shards is %zd. Record file: %s", shard_index, num_shards, m_path.c_str());
+	m_shard_index = shard_index;
+	m_num_shards = num_shards;
+	m_first_record = first_record;
+}
 
-	offset += sizeof(RecordHeader) + header.length + sizeof(uint32_t);
-	assert(offset == m_file.Tell());
+fsal::Status RecordReader::SkipToShard()
+{
+	size_t skip = (m_shard_index + m_num_shards - (m_first_record + m_record_number) % m_num_shards) % m_num_shards;
+	if (skip == 0)
+	{
+		return true;
+	}
+
+	if (m_index)
+	{
+		if (m_record_number + skip >= m_index->size())
+		{
+			m_record_number = m_index->size();
+			return fsal::Status::kEOF;
+		}
+		m_record_number += skip;
+		m_offset = m_index->offsets[m_record_number];
+		return true;
+	}
+
+	for (; skip != 0; --skip)
+	{
+		RecordHeader header = { 0 };
+		auto status = ReadChecksummed(m_offset, sizeof(RecordHeader::length), (uint8_t*)&header, VerifyHeader());
+		if (status.is_eof())
+		{
+			return status;
+		}
+		m_offset += sizeof(RecordHeader) + GetRecordLength(header.length) + sizeof(uint32_t);
+		++m_record_number;
+	}
 	return true;
 }
 
 fsal::Status RecordReader::GetNext()
 {
-	fsal::Status s = ReadRecord(m_offset, &m_mem_file);
+	fsal::Status s = SkipToShard();
+	if (s.is_eof())
+		return s;
+	m_record_offset = m_offset;
+	s = ReadRecord(m_offset, &m_mem_file);
+	if (s.ok() && !s.is_eof())
+		++m_record_number;
 	return s;
 }
 
 fsal::Status RecordReader::GetNext(std::function<void*(size_t size)> alloc_func)
 {
-	fsal::Status s = ReadRecord(m_offset, std::move(alloc_func));
+	fsal::Status s = SkipToShard();
+	if (s.is_eof())
+		return s;
+	m_record_offset = m_offset;
+	s = ReadRecord(m_offset, std::move(alloc_func));
+	if (s.ok() && !s.is_eof())
+		++m_record_number;
+	return s;
+}
+
+fsal::Status RecordReader::GetNextView(const uint8_t*& data, size_t& size)
+{
+	fsal::Status s = SkipToShard();
+	if (s.is_eof())
+		return s;
+	m_record_offset = m_offset;
+	s = ReadRecordView(m_offset, data, size);
+	if (s.ok() && !s.is_eof())
+		++m_record_number;
 	return s;
 }
 
@@ -144,26 +800,100 @@ RecordReader::Metadata RecordReader::GetMetadata()
 {
 	if (m_metadata.file_size == -1)
 	{
-		m_file.Seek(0);
-		m_metadata.data_size = 0;
-		m_metadata.entries = 0;
-		m_metadata.file_size = m_file.GetSize();
-
-		uint64_t offset = 0;
-		while (offset < m_metadata.file_size)
+		RecordIndex scanned;
+		const RecordIndex* index = m_index.get();
+		if (index == nullptr)
 		{
-			RecordHeader header = { 0 };
-			auto status = ReadChecksummed(offset, sizeof(RecordHeader::length), (uint8_t*)&header);
-			if (status.is_eof())
-				break;
-
-			m_file.Seek(header.length + sizeof(uint32_t), fsal::File::CurrentPosition);
-			offset += sizeof(RecordHeader) + header.length + sizeof(uint32_t);
-
-			m_metadata.data_size += header.length;
-			++m_metadata.entries;
+			BuildIndex(scanned);
+			index = &scanned;
 		}
+		m_metadata.data_size = index->data_size();
+		m_metadata.entries = index->size();
 		m_metadata.file_size = m_metadata.data_size + (sizeof(RecordHeader) + sizeof(uint32_t)) * m_metadata.entries;
 	}
 	return m_metadata;
 }
+
+void RecordReader::BuildIndex(RecordIndex& index)
+{
+	index.offsets.clear();
+	index.lengths.clear();
+	index.header_crcs.clear();
+
+	uint64_t offset = 0;
+	while (true)
+	{
+		RecordHeader header = { 0 };
+		auto status = ReadChecksummed(offset, sizeof(RecordHeader::length), (uint8_t*)&header, VerifyHeader());
+		if (status.is_eof())
+			break;
+
+		index.offsets.push_back(offset);
+		index.lengths.push_back(GetRecordLength(header.length));
+		index.header_crcs.push_back(Mask(crc32c_value((uint8_t*)&header.length, sizeof(RecordHeader::length))));
+
+		offset += sizeof(RecordHeader) + GetRecordLength(header.length) + sizeof(uint32_t);
+	}
+}
+
+bool RecordReader::LoadIndex(bool build, bool save)
+{
+	if (m_index)
+		return true;
+
+	uint64_t file_size = 0;
+	uint64_t mtime = 0;
+	bool has_stamp = GetFileStamp(m_path, file_size, mtime);
+	std::string sidecar = RecordIndex::SidecarPath(m_path);
+
+	std::string checkpoints_sidecar = fsal::ZlibFile::SidecarPath(m_path);
+
+	// While inflating in the background, the decompressor belongs to the worker thread, checkpoints are not used
+	fsal::ZlibFile* zlib_file = m_read_ahead_file ? nullptr : m_zlib_file.get();
+
+	std::unique_ptr<RecordIndex> index(new RecordIndex);
+	bool loaded = has_stamp && index->Load(sidecar, file_size, mtime);
+	bool checkpoints_loaded = !zlib_file || (has_stamp && zlib_file->LoadCheckpoints(checkpoints_sidecar, file_size, mtime));
+
+	if (!loaded && !build)
+		return false;
+
+	if (build && !(loaded && checkpoints_loaded))
+	{
+		// Scanning compressed file decompresses all of it, which records inflate checkpoints as well
+		BuildIndex(*index);
+
+		// Failing to write the sidecar (e.g. read-only location) is not an error, the index is kept in memory
+		if (save && has_stamp)
+		{
+			index->Save(sidecar, file_size, mtime);
+			if (zlib_file && zlib_file->CheckpointsComplete())
+				zlib_file->SaveCheckpoints(checkpoints_sidecar, file_size, mtime);
+		}
+	}
+	m_index = std::move(index);
+	m_metadata.file_size = -1;
+	return true;
+}
+
+fsal::Status RecordReader::ReadRecordByNumber(size_t number, std::function<void*(size_t size)> alloc_func)
+{
+	if (!m_index)
+		throw runtime_error("Record index is not loaded. Record file: %s", m_path.c_str());
+	if (number >= m_index->size())
+		throw runtime_error("Record number %zd is out of range, file has %zd records. Record file: %s", number, m_index->size(), m_path.c_str());
+
+	uint64_t offset = m_index->offsets[number];
+	return ReadRecord(offset, std::move(alloc_func));
+}
+
+fsal::Status RecordReader::ReadRecordViewByNumber(size_t number, const uint8_t*& data, size_t& size)
+{
+	if (!m_index)
+		throw runtime_error("Record index is not loaded. Record file: %s", m_path.c_str());
+	if (number >= m_index->size())
+		throw runtime_error("Record number %zd is out of range, file has %zd records. Record file: %s", number, m_index->size(), m_path.c_str());
+
+	uint64_t offset = m_index->offsets[number];
+	return ReadRecordView(offset, data, size);
+}
@@ -15,9 +15,21 @@
 #pragma once
 #include <inttypes.h>
 #include <memory>
+#include <vector>
 #include <fsal.h>
 #include <MemRefFile.h>
 #include <bfio.h>
+#include "record_index.h"
+#include "io_engine.h"
+#include "read_advice.h"
+#include "record_compression.h"
+
+namespace fsal
+{
+	class AsyncReadFile;
+	class ZlibFile;
+	class ReadAheadFile;
+}
 
 
 #pragma pack(push,1)
@@ -28,6 +40,20 @@ struct RecordHeader
 };
 #pragma pack(pop)
 
+// Crc of tfrecords is stored masked
+static const uint32_t kMaskDelta = 0xa282ead8ul;
+
+inline uint32_t Mask(uint32_t crc)
+{
+	return ((crc >> 15) | (crc << 17)) + kMaskDelta;
+}
+
+inline uint32_t Unmask(uint32_t masked_crc)
+{
+	uint32_t rot = masked_crc - kMaskDelta;
+	return ((rot >> 17) | (rot << 15));
+}
+
 
 class RecordReader
 {
@@ -36,7 +62,41 @@ public:
 	{
 		None,
 		ZLIB,
-		GZIP
+		GZIP,
+		LZ4
+	};
+
+	enum ReadMode
+	{
+		Stream,
+		MMap,
+		Buffered,
+		Async,
+		Direct
+	};
+
+	// Decoder of GZIP and ZLIB compressed files
+	enum InflateBackend
+	{
+		ZlibInflate,       // streaming inflate, memory use does not depend on the file size
+		LibdeflateInflate  // faster whole-file decode, the decompressed file is kept in memory
+	};
+
+	// Which checksums are verified while reading
+	enum Verification
+	{
+		VerifyFull,         // header and payload of every record
+		VerifyHeaderOnly,   // only headers, which guards record framing
+		VerifySampled,      // headers, and payloads of every `sample_rate`-th record
+		VerifyNone
+	};
+
+	enum
+	{
+		DefaultBlockSize = 1024 * 1024,
+		DefaultIODepth = 8,
+		DefaultInflateBlockSize = 4 * 1024 * 1024,
+		DefaultInflateDepth = 4
 	};
 
 	RecordReader(const RecordReader&) = delete; // non construction-copyable
@@ -49,30 +109,162 @@ public:
 		int64_t entries = -1;
 	};
 
-	explicit RecordReader(fsal::File file, Compression compression);
+	explicit RecordReader(fsal::File file, Compression compression, ReadMode mode = Stream, size_t block_size = DefaultBlockSize,
+	                      int io_depth = DefaultIODepth, std::shared_ptr<IOEngine> engine = nullptr, bool advise = false,
+	                      InflateBackend inflate_backend = ZlibInflate);
 
-	explicit RecordReader(const std::string& file, Compression compression);
+	explicit RecordReader(const std::string& file, Compression compression, ReadMode mode = Stream, size_t block_size = DefaultBlockSize,
+	                      int io_depth = DefaultIODepth, std::shared_ptr<IOEngine> engine = nullptr, bool advise = false,
+	                      InflateBackend inflate_backend = ZlibInflate);
 
-	virtual ~RecordReader() = default;
+	virtual ~RecordReader();
 
 	fsal::Status ReadRecord(uint64_t& offset, fsal::MemRefFile* mem_file);
 
 	fsal::Status ReadRecord(uint64_t& offset, std::function<void*(size_t size)> alloc_func);
 
+	// Reads records at given offsets. Offsets are processed in ascending order, records that are close to each other
+	// are fetched with a single read. `alloc_func` is called with the position of the offset in `offsets`.
+	void ReadRecords(const std::vector<uint64_t>& offsets, std::function<void*(size_t index, size_t size)> alloc_func);
+
+	// Returns a pointer to the record payload inside of the mapped file. Checksums are verified in place.
+	// Only available in MMap mode, the pointer stays valid as long as the underlying file is alive.
+	fsal::Status ReadRecordView(uint64_t& offset, const uint8_t*& data, size_t& size);
+
 	Metadata GetMetadata();
 
+	void SetVerification(Verification verification, int sample_rate = 1);
+
+	Verification verification() const { return m_verification; }
+
+	// Records with individually compressed payloads are decompressed on read by default. If disabled, payloads are
+	// returned as stored, and `record_compression()` tells how the last read record is compressed, so that the caller
+	// can decompress records later, e.g. in parallel.
+	void SetRecordDecompression(bool decompress) { m_decompress_records = decompress; }
+
+	RecordCompression record_compression() const { return m_record_compression; }
+
+	// Loads the record index from the sidecar file. If it is missing or outdated and `build` is true, the index is
+	// built by scanning the file, and if `save` is true, it is written next to the file.
+	// For compressed files, inflate checkpoints are loaded, built and saved the same way.
+	// Returns false if no index is available.
+	bool LoadIndex(bool build = true, bool save = true);
+
+	const RecordIndex* index() const { return m_index.get(); }
+
+	// Reads a record by its number. Requires the index to be loaded.
+	fsal::Status ReadRecordByNumber(size_t number, std::function<void*(size_t size)> alloc_func);
+
+	fsal::Status ReadRecordViewByNumber(size_t number, const uint8_t*& data, size_t& size);
+
+	// Makes GetNext return only records whose number equals `shard_index` modulo `num_shards`. Records are numbered
+	// from `first_record`, so that a sequence of files is sharded as one, given the number of records before the file.
+	// Other records are skipped by the index if it is loaded, otherwise by their headers, without reading payloads.
+	void SetSharding(size_t shard_index, size_t num_shards, size_t first_record = 0);
+
 	fsal::Status GetNext();
 
 	fsal::Status GetNext(std::function<void*(size_t size)> alloc_func);
 
+	fsal::Status GetNextView(const uint8_t*& data, size_t& size);
+
 	const fsal::MemRefFile& record() const { return m_mem_file; }
 
 	uint64_t offset() const { return m_offset; }
 
+	// Offset of the record last returned by GetNext, e.g. to read it again with ReadRecord
+	uint64_t record_offset() const { return m_record_offset; }
+
+	// Number of the record at `offset()` in the file. Once GetNext reaches the end, it is the number of records
+	size_t record_number() const { return m_record_number; }
+
+	// GetNext continues from the record at `offset`, which is the `record_number`-th record of the file. The number
+	// is only needed for sharding.
+	void Seek(uint64_t offset, size_t record_number = 0)
+	{
+		m_offset = offset;
+		m_record_number = record_number;
+	}
+
+	ReadMode mode() const { return m_mode; }
+
+	const fsal::File& file() const { return m_file; }
+
+	// Async mode only. Starts issuing reads without waiting for the first record to be requested.
+	void StartPrefetch();
+
+	// Async mode, or inflating in the background. True if reads were issued up to the end of the file.
+	bool PrefetchExhausted() const;
+
+	// Compressed files only. Decompression moves to a worker thread, which stays up to `depth` blocks of
+	// `block_size` decompressed bytes ahead of the reader. Record framing and crc checks then run on already
+	// decompressed data. Inflate checkpoints are not used afterwards.
+	void StartBackgroundInflate(size_t block_size = DefaultInflateBlockSize, int depth = DefaultInflateDepth);
+
+	// GZIP and ZLIB files with the zlib backend only. Members of multi-member files (e.g. concatenated gzip files) are
+	// inflated concurrently by `threads` threads, once member boundaries are known. Boundaries are recorded by
+	// LoadIndex and saved with inflate checkpoints. Zero disables it.
+	void SetParallelInflate(int threads);
+
 private:
-	fsal::Status ReadChecksummed(uint64_t offset, size_t size, uint8_t* data);
+	// Compressed record of a batch, waiting to be decompressed to `dst`. Payload is either referenced or copied.
+	struct PendingRecord
+	{
+		RecordCompression compression = RecordUncompressed;
+		uint64_t offset = 0;
+		const uint8_t* payload = nullptr;
+		size_t size = 0;
+		std::vector<uint8_t> copy;
+		size_t uncompressed_size = 0;
+		uint8_t* dst = nullptr;
+	};
+
+	void Init(Compression compression, ReadMode mode, size_t block_size, int io_depth, std::shared_ptr<IOEngine> engine, bool advise,
+	          InflateBackend inflate_backend);
+	void Advise(uint64_t offset);
+	fsal::Status ReadAt(uint64_t offset, uint8_t* dst, size_t size, size_t* bytes_read);
+	fsal::Status ReadBuffered(uint64_t offset, uint8_t* dst, size_t size, size_t* bytes_read);
+	fsal::Status ReadChecksummed(uint64_t offset, size_t size, uint8_t* data, bool verify);
+	bool VerifyHeader() const;
+	bool VerifyPayload();
+	fsal::Status ReadRawView(uint64_t& offset, const uint8_t*& data, size_t& size);
+	void DecompressPending(std::vector<PendingRecord>& pending);
+	void DecompressPayload(uint64_t offset, const uint8_t* payload, size_t size, const std::function<void*(size_t size)>& alloc_func);
+	void BuildIndex(RecordIndex& index);
+	fsal::Status SkipToShard();
 	fsal::MemRefFile m_mem_file;
 	uint64_t m_offset;
+	size_t m_record_number = 0; // number of the record at m_offset
+	uint64_t m_record_offset = 0;
+	size_t m_shard_index = 0;
+	size_t m_num_shards = 1;
+	size_t m_first_record = 0;
 	fsal::File m_file;
+	ReadMode m_mode;
+	Verification m_verification = VerifyFull;
+	int m_sample_rate = 1;
+	uint64_t m_payload_counter = 0;
+	Compression m_compression;
+	bool m_decompress_records = true;
+	RecordCompression m_record_compression = RecordUncompressed;
+	std::vector<uint8_t> m_scratch;
+	const uint8_t* m_data = nullptr;
+	size_t m_data_size = 0;
+	std::string m_path;
+
+	// Buffered mode. Block holds [m_block_offset, m_block_offset + m_block_fill) range of the file
+	std::unique_ptr<uint8_t[]> m_block;
+	size_t m_block_size = 0;
+	uint64_t m_block_offset = 0;
+	size_t m_block_fill = 0;
+
+	std::shared_ptr<fsal::AsyncReadFile> m_async_file;
+	std::shared_ptr<fsal::ZlibFile> m_zlib_file;
+	std::shared_ptr<fsal::ReadAheadFile> m_read_ahead_file;
+
+	// Kernel hints, positions are taken from the file under the decompressor
+	std::unique_ptr<ReadAdvice> m_advice;
+	std::shared_ptr<fsal::FileInterface> m_source;
+	std::unique_ptr<RecordIndex> m_index;
 	Metadata m_metadata;
 };
@@ -0,0 +1,197 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "record_writer.h"
+#include <algorithm>
+#include <climits>
+#include <crc32c/crc32c.h>
+#include "lz4frame.h"
+#include "common.h"
+
+
+enum
+{
+	OutputBufferSize = 256 * 1024
+};
+
+RecordWriter::RecordWriter(const std::string& filename, RecordReader::Compression compression, RecordCompression record_compression):
+	m_filename(filename), m_compression(compression), m_record_compression(record_compression)
+{
+	m_stream = z_stream();
+	size_t header_size = 0;
+	if (compression == RecordReader::GZIP || compression == RecordReader::ZLIB)
+	{
+		int window = compression == RecordReader::GZIP ? MAX_WBITS + 16 : MAX_WBITS;
+		if (deflateInit2(&m_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			throw runtime_error("Failed to init zlib");
+		m_buffer.resize(OutputBufferSize);
+	}
+	else if (compression == RecordReader::LZ4)
+	{
+		LZ4F_errorCode_t status = LZ4F_createCompressionContext(&m_lz4_ctx, LZ4F_VERSION);
+		if (LZ4F_isError(status))
+			throw runtime_error("Failed to init lz4: %s", LZ4F_getErrorName(status));
+		m_buffer.resize(LZ4F_HEADER_SIZE_MAX);
+		header_size = LZ4F_compressBegin(m_lz4_ctx, m_buffer.data(), m_buffer.size(), nullptr);
+		if (LZ4F_isError(header_size))
+		{
+			LZ4F_freeCompressionContext(m_lz4_ctx);
+			throw runtime_error("LZ4 compression failed: %s", LZ4F_getErrorName(header_size));
+		}
+	}
+
+	m_fp = std::fopen(filename.c_str(), "wb");
+	if (!m_fp)
+	{
+		Close();
+		throw runtime_error("Can't open file for writing: %s", filename.c_str());
+	}
+
+	// Frame header of lz4
+	Flush(m_buffer.data(), header_size);
+}
+
+RecordWriter::~RecordWriter()
+{
+	try
+	{
+		Close();
+	}
+	catch (const std::exception&)
+	{
+	}
+}
+
+void RecordWriter::WriteRecord(const uint8_t* data, size_t size)
+{
+	if (!m_fp)
+		throw runtime_error("Can't write record, file is closed: %s", m_filename.c_str());
+
+	std::vector<uint8_t> payload;
+	if (m_record_compression != RecordUncompressed)
+	{
+		payload = CompressRecord(m_record_compression, data, size);
+		data = payload.data();
+		size = payload.size();
+	}
+	if (size > kRecordLengthMask)
+		throw runtime_error("Record of size %zd is too large. File: %s", size, m_filename.c_str());
+
+	RecordHeader header;
+	header.length = size | (uint64_t(m_record_compression) << RecordCompressionShift);
+	header.crc_of_length = Mask(crc32c_value((uint8_t*)&header.length, sizeof(RecordHeader::length)));
+	uint32_t masked_crc = Mask(crc32c_value(data, size));
+
+	Write((const uint8_t*)&header, sizeof(RecordHeader));
+	Write(data, size);
+	Write((const uint8_t*)&masked_crc, sizeof(uint32_t));
+}
+
+void RecordWriter::Close()
+{
+	// Compressor state and the file are released even if finishing the stream fails
+	try
+	{
+		Finish();
+	}
+	catch (const std::exception&)
+	{
+		Release();
+		throw;
+	}
+	if (!Release())
+		throw runtime_error("Failed to write file: %s", m_filename.c_str());
+}
+
+void RecordWriter::Finish()
+{
+	if (m_fp && m_stream.state != nullptr)
+	{
+		int result = Z_OK;
+		while (result != Z_STREAM_END)
+		{
+			m_stream.next_out = m_buffer.data();
+			m_stream.avail_out = m_buffer.size();
+			result = deflate(&m_stream, Z_FINISH);
+			if (result != Z_OK && result != Z_STREAM_END)
+				throw runtime_error("Deflate failed: %s", m_stream.msg);
+			Flush(m_buffer.data(), m_buffer.size() - m_stream.avail_out);
+		}
+	}
+	if (m_fp && m_lz4_ctx)
+	{
+		m_buffer.resize(LZ4F_compressBound(0, nullptr));
+		size_t size = LZ4F_compressEnd(m_lz4_ctx, m_buffer.data(), m_buffer.size(), nullptr);
+		if (LZ4F_isError(size))
+			throw runtime_error("LZ4 compression failed: %s", LZ4F_getErrorName(size));
+		Flush(m_buffer.data(), size);
+	}
+}
+
+bool RecordWriter::Release()
+{
+	if (m_stream.state != nullptr)
+		deflateEnd(&m_stream);
+	if (m_lz4_ctx)
+		LZ4F_freeCompressionContext(m_lz4_ctx);
+	m_lz4_ctx = nullptr;
+
+	bool ok = true;
+	if (m_fp)
+	{
+		ok = std::fclose(m_fp) == 0;
+		m_fp = nullptr;
+	}
+	return ok;
+}
+
+void RecordWriter::Write(const uint8_t* data, size_t size)
+{
+	if (m_stream.state != nullptr)
+	{
+		// avail_in is 32-bit, so large records are fed in chunks
+		m_stream.next_in = (Bytef*)data;
+		while (size > 0 || m_stream.avail_in > 0)
+		{
+			if (m_stream.avail_in == 0)
+			{
+				m_stream.avail_in = uInt(std::min(size, size_t(UINT_MAX)));
+				size -= m_stream.avail_in;
+			}
+			m_stream.next_out = m_buffer.data();
+			m_stream.avail_out = m_buffer.size();
+			if (deflate(&m_stream, Z_NO_FLUSH) != Z_OK)
+				throw runtime_error("Deflate failed: %s", m_stream.msg);
+			Flush(m_buffer.data(), m_buffer.size() - m_stream.avail_out);
+		}
+	}
+	else if (m_lz4_ctx)
+	{
+		m_buffer.resize(std::max(m_buffer.size(), LZ4F_compressBound(size, nullptr)));
+		size_t compressed = LZ4F_compressUpdate(m_lz4_ctx, m_buffer.data(), m_buffer.size(), data, size, nullptr);
+		if (LZ4F_isError(compressed))
+			throw runtime_error("LZ4 compression failed: %s", LZ4F_getErrorName(compressed));
+		Flush(m_buffer.data(), compressed);
+	}
+	else
+	{
+		Flush(data, size);
+	}
+}
+
+void RecordWriter::Flush(const uint8_t* data, size_t size)
+{
+	if (size > 0 && std::fwrite(data, 1, size, m_fp) != size)
+		throw runtime_error("Failed to write file: %s", m_filename.c_str());
+}
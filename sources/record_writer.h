@@ -0,0 +1,56 @@
+//   Copyright 2019-2020 Stanislav Pidhorskyi
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "record_readers.h"
+#include "zlib.h"
+
+struct LZ4F_cctx_s;
+
+
+// Writes records to a tfrecord file, optionally compressed. Compressed data is flushed on Close.
+// With `record_compression`, payload of each record is compressed on its own (see record_compression.h).
+class RecordWriter
+{
+public:
+	RecordWriter(const RecordWriter&) = delete; // non construction-copyable
+	RecordWriter& operator=( const RecordWriter&) = delete; // non copyable
+
+	RecordWriter(const std::string& filename, RecordReader::Compression compression,
+	             RecordCompression record_compression = RecordUncompressed);
+
+	virtual ~RecordWriter();
+
+	void WriteRecord(const uint8_t* data, size_t size);
+
+	void Close();
+
+private:
+	void Finish();
+	// Frees compressor state and closes the file. Returns false if closing the file failed
+	bool Release();
+	void Write(const uint8_t* data, size_t size);
+	void Flush(const uint8_t* data, size_t size);
+
+	std::string m_filename;
+	RecordReader::Compression m_compression;
+	RecordCompression m_record_compression;
+	FILE* m_fp = nullptr;
+	z_stream m_stream;
+	LZ4F_cctx_s* m_lz4_ctx = nullptr;
+	std::vector<uint8_t> m_buffer;
+};
@@ -14,39 +14,278 @@
 
 #pragma once
 #include "record_readers.h"
+#include "record_prefetcher.h"
+#include "record_arena.h"
+#include "record_dataset.h"
 #include "example.h"
 #include <vector>
+#include <deque>
 #include <string>
 #include <random>
 #include <atomic>
 #include <mutex>
 #include <assert.h>
 #include <thread>
+#include <sstream>
+#include <algorithm>
 #include <condition_variable>
 
 
+// How records are split between data-parallel workers
+enum Sharding
+{
+	ShardFiles,   // each worker takes every `num_shards`-th file
+	ShardRecords  // each worker takes every `num_shards`-th record of all files, numbered across files
+};
+
+// Keeps files of the given shard, if files are sharded. Yielders apply it after the seeded shuffle, so all workers
+// agree on the split of each epoch, as long as they use the same seed
+inline void ShardFilenames(std::vector<std::string>& filenames, int shard_index, int num_shards, Sharding sharding)
+{
+	if (num_shards < 1 || shard_index < 0 || shard_index >= num_shards)
+	{
+		throw runtime_error("Shard index %d is out of range, number of shards is %d", shard_index, num_shards);
+	}
+	if (sharding != ShardFiles)
+	{
+		return;
+	}
+	std::vector<std::string> selected;
+	for (size_t i = shard_index; i < filenames.size(); i += num_shards)
+	{
+		selected.push_back(filenames[i]);
+	}
+	filenames = std::move(selected);
+}
+
+// Records of other shards are skipped by the index if its sidecar exists. The index is not built here, since that
+// would read the whole file on each worker. `first_record` is the number of records in the files before this one,
+// numbering records across files keeps shards within one record of each other, whatever the sizes of files are.
+inline void SetRecordSharding(RecordReader* rr, int shard_index, int num_shards, size_t first_record)
+{
+	if (num_shards > 1)
+	{
+		if (rr->index() == nullptr)
+		{
+			rr->LoadIndex(false);
+		}
+		rr->SetSharding(shard_index, num_shards, first_record);
+	}
+}
+
+
+// Shuffle buffer is full once either limit is reached, a non-positive limit is not applied. The record that crosses
+// the byte limit is still kept, so the buffer exceeds it by less than one record
+inline bool ShuffleBufferFull(size_t records, uint64_t bytes, int buffsize, uint64_t buffer_bytes)
+{
+	return (buffsize > 0 && records >= size_t(buffsize)) || (buffer_bytes > 0 && bytes >= buffer_bytes);
+}
+
+inline void CheckShuffleBufferLimits(int buffsize, uint64_t buffer_bytes)
+{
+	if (buffsize <= 0 && buffer_bytes == 0)
+	{
+		throw runtime_error("Shuffle buffer needs a limit, either buffer_size or buffer_bytes must be positive");
+	}
+}
+
+
+// Records read by background threads are copied to bytes objects, which can only be created while holding the GIL
+inline py::list RecordsToList(const std::vector<std::string>& records)
+{
+	if (records.empty())
+	{
+		throw py::stop_iteration();
+	}
+	py::list batch;
+	for (const auto& record: records)
+	{
+		batch.append(py::bytes(record));
+	}
+	return batch;
+}
+
+
+// Where a buffered record was read from, enough to read it again when a yielder state is restored
+struct RecordLocation
+{
+	int file;
+	uint64_t offset;
+};
+
+inline std::string SaveRandomState(const std::mt19937_64& rnd)
+{
+	std::ostringstream stream;
+	stream << rnd;
+	return stream.str();
+}
+
+inline std::mt19937_64 LoadRandomState(const std::string& state)
+{
+	std::mt19937_64 rnd;
+	std::istringstream stream(state);
+	stream >> rnd;
+	if (stream.fail())
+	{
+		throw runtime_error("Invalid random generator state");
+	}
+	return rnd;
+}
+
+// Reads records at `locations` again. Records are read file by file, in order of offsets, so each file is opened
+// once and read forward. `read` is called with the index of the location and the reader of its file.
+inline void ReadLocations(const std::vector<RecordLocation>& locations, const std::function<RecordReader*(int file)>& open,
+                          const std::function<void(size_t i, RecordReader* rr, uint64_t offset)>& read)
+{
+	std::vector<size_t> order(locations.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&locations](size_t a, size_t b)
+	{
+		return locations[a].file < locations[b].file || (locations[a].file == locations[b].file && locations[a].offset < locations[b].offset);
+	});
+
+	std::unique_ptr<RecordReader> rr;
+	int file = -1;
+	for (size_t i: order)
+	{
+		if (locations[i].file != file)
+		{
+			file = locations[i].file;
+			rr.reset(open(file));
+			rr->LoadIndex(false);
+		}
+		read(i, rr.get(), locations[i].offset);
+	}
+}
+
+// Fields of a yielder state that do not depend on the kind of the buffer. See `get_state` of RecordYielderRandomized
+inline py::dict SavePosition(const std::vector<std::string>& filenames, int current_file, size_t first_record, const RecordReader* rr,
+                             const std::mt19937_64& rnd, const std::vector<RecordLocation>& locations)
+{
+	py::dict state;
+	state["filenames"] = filenames;
+	state["current_file"] = current_file;
+	state["first_record"] = first_record;
+	state["offset"] = rr ? rr->offset() : 0;
+	state["record_number"] = rr ? rr->record_number() : 0;
+	state["random_state"] = SaveRandomState(rnd);
+	py::list buffer_locations;
+	for (const auto& location: locations)
+	{
+		buffer_locations.append(py::make_tuple(location.file, location.offset));
+	}
+	state["buffer_locations"] = buffer_locations;
+	return state;
+}
+
+// Restores fields saved by SavePosition. The reader of the current file is opened at its saved offset, or set to
+// nullptr if the file is not started yet
+inline void LoadPosition(const py::dict& state, std::vector<std::string>& filenames, int& current_file, size_t& first_record,
+                         RecordReader*& rr, std::mt19937_64& rnd, const std::function<RecordReader*(int file)>& open)
+{
+	filenames = state["filenames"].cast<std::vector<std::string>>();
+	current_file = state["current_file"].cast<int>();
+	first_record = state["first_record"].cast<size_t>();
+	rnd = LoadRandomState(state["random_state"].cast<std::string>());
+
+	uint64_t offset = state["offset"].cast<uint64_t>();
+	size_t record_number = state["record_number"].cast<size_t>();
+	delete rr;
+	rr = nullptr;
+	if ((offset != 0 || record_number != 0) && current_file < int(filenames.size()))
+	{
+		// Compressed files are sought with inflate checkpoints, if their sidecar exists
+		rr = open(current_file);
+		rr->LoadIndex(false);
+		rr->Seek(offset, record_number);
+	}
+}
+
+inline std::vector<RecordLocation> LoadLocations(const py::dict& state, size_t files)
+{
+	std::vector<RecordLocation> locations;
+	for (auto item: state["buffer_locations"].cast<py::list>())
+	{
+		auto location = item.cast<py::tuple>();
+		locations.push_back({ location[0].cast<int>(), location[1].cast<uint64_t>() });
+		if (locations.back().file < 0 || size_t(locations.back().file) >= files)
+		{
+			throw runtime_error("Invalid yielder state, file %d of a buffered record is out of range", locations.back().file);
+		}
+	}
+	return locations;
+}
+
+
 class HIDDEN RecordYielderBasic
 {
 public:
 	RecordYielderBasic(const RecordYielderBasic&) = delete; // non construction-copyable
 	RecordYielderBasic& operator=( const RecordYielderBasic&) = delete; // non copyable
 
-	explicit RecordYielderBasic(std::vector<std::string>& filenames, RecordReader::Compression compression)
+	explicit RecordYielderBasic(std::vector<std::string>& filenames, RecordReader::Compression compression, int io_depth = 0, bool advise = false,
+	                            bool background_inflate = false, int prefetch_depth = 0, int reader_threads = 1, int shard_index = 0,
+	                            int num_shards = 1, Sharding sharding = ShardFiles)
 	{
 		m_filenames = filenames;
 		m_compression = compression;
+		m_shard_index = shard_index;
+		m_num_shards = num_shards;
+		ShardFilenames(m_filenames, shard_index, num_shards, sharding);
 		m_current_file = 0;
 		m_rr = nullptr;
+		m_next_rr = nullptr;
 		m_compression = compression;
+		m_io_depth = io_depth;
+		m_advise = advise;
+		m_background_inflate = background_inflate;
+		m_shard_readers = sharding == ShardRecords && prefetch_depth <= 0;
+		if (prefetch_depth > 0)
+		{
+			// Reader threads can not share an engine, each reader gets its own
+			m_prefetcher.reset(new RecordPrefetcher(m_filenames.size(), [this](size_t file)
+			{
+				return OpenReader(int(file), nullptr);
+			}, reader_threads, prefetch_depth));
+			if (sharding == ShardRecords)
+			{
+				m_prefetcher->SetSharding(shard_index, num_shards);
+			}
+		}
+		else if (m_io_depth > 0)
+		{
+			// One engine for all the files, so that reads of the next file are in flight while the current is consumed
+			m_engine = IOEngine::Create(m_io_depth * 2);
+		}
 	}
 
 	virtual ~RecordYielderBasic()
 	{
+		m_prefetcher.reset();
 		delete m_rr;
+		delete m_next_rr;
 	}
 
 	py::object GetNext()
 	{
+		if (m_prefetcher)
+		{
+			std::string record;
+			bool ok = false;
+			{
+				py::gil_scoped_release release;
+				ok = m_prefetcher->Next(record);
+			}
+			if (!ok)
+			{
+				throw py::stop_iteration();
+			}
+			return py::bytes(record);
+		}
+
 		PyBytesObject* bytesObject = nullptr;
 
 		if (m_rr == nullptr)
@@ -56,7 +295,7 @@ public:
 				throw py::stop_iteration();
 			}
 
-			m_rr = new RecordReader(m_filenames[m_current_file], m_compression);
+			m_rr = OpenReader(m_current_file, m_engine);
 		}
 
 		auto status = m_rr->GetNext(GetBytesAllocator(bytesObject));
@@ -64,9 +303,7 @@ public:
 		{
 			if (status.is_eof())
 			{
-				delete m_rr;
-				m_rr = nullptr;
-				++m_current_file;
+				NextFile();
 				return GetNext();
 			}
 			else
@@ -74,11 +311,26 @@ public:
 				throw runtime_error("Error while iterating RecordReader at offset: %zd", m_rr->offset());
 			}
 		}
+		PrefetchNextFile();
 		return py::reinterpret_steal<py::object>((PyObject*) bytesObject);
 	}
 
 	py::list GetNextN(int n)
 	{
+		if (m_prefetcher)
+		{
+			std::vector<std::string> records;
+			{
+				py::gil_scoped_release release;
+				std::string record;
+				while (int(records.size()) < n && m_prefetcher->Next(record))
+				{
+					records.push_back(std::move(record));
+				}
+			}
+			return RecordsToList(records);
+		}
+
 		py::list batch;
 		for (int i = 0; i < n; ++i)
 		{
@@ -100,7 +352,7 @@ public:
 						}
 					}
 
-					m_rr = new RecordReader(m_filenames[m_current_file], m_compression);
+					m_rr = OpenReader(m_current_file, m_engine);
 				}
 
 				auto status = m_rr->GetNext(GetBytesAllocator(bytesObject));
@@ -108,9 +360,7 @@ public:
 				{
 					if (status.is_eof())
 					{
-						delete m_rr;
-						m_rr = nullptr;
-						++m_current_file;
+						NextFile();
 						continue;
 					}
 					else
@@ -120,6 +370,7 @@ public:
 				}
 				py::object value = py::reinterpret_steal<py::object>((PyObject*) bytesObject);
 				batch.append(std::move(value));
+				PrefetchNextFile();
 				break;
 			}
 		}
@@ -127,10 +378,69 @@ public:
 	}
 
 private:
+	RecordReader* OpenReader(int file, const std::shared_ptr<IOEngine>& engine)
+	{
+		RecordReader* rr = nullptr;
+		if (m_io_depth > 0)
+		{
+			rr = new RecordReader(m_filenames[file], m_compression, RecordReader::Async,
+			                      RecordReader::DefaultBlockSize, m_io_depth, engine, m_advise);
+		}
+		else
+		{
+			rr = new RecordReader(m_filenames[file], m_compression, RecordReader::Stream,
+			                      RecordReader::DefaultBlockSize, RecordReader::DefaultIODepth, nullptr, m_advise);
+		}
+		if (m_background_inflate)
+		{
+			rr->StartBackgroundInflate();
+		}
+		if (m_shard_readers)
+		{
+			SetRecordSharding(rr, m_shard_index, m_num_shards, m_first_record);
+		}
+		return rr;
+	}
+
+	void NextFile()
+	{
+		m_first_record += m_rr->record_number();
+		delete m_rr;
+		m_rr = m_next_rr;
+		m_next_rr = nullptr;
+		++m_current_file;
+		// Next file was opened before the number of records of this one was known
+		if (m_rr && m_shard_readers)
+		{
+			m_rr->SetSharding(m_shard_index, m_num_shards, m_first_record);
+		}
+	}
+
+	// Once all reads (or inflate) of the current file are issued, the next file is opened and starts reading ahead
+	void PrefetchNextFile()
+	{
+		bool reads_ahead = m_engine || (m_background_inflate && m_compression != RecordReader::None);
+		if (reads_ahead && m_next_rr == nullptr && m_rr->PrefetchExhausted() && m_current_file + 1 < int(m_filenames.size()))
+		{
+			m_next_rr = OpenReader(m_current_file + 1, m_engine);
+			m_next_rr->StartPrefetch();
+		}
+	}
+
 	std::vector<std::string> m_filenames;
 	RecordReader::Compression m_compression;
 	RecordReader* m_rr;
+	RecordReader* m_next_rr;
 	int m_current_file;
+	int m_io_depth;
+	bool m_advise;
+	bool m_background_inflate;
+	int m_shard_index;
+	int m_num_shards;
+	bool m_shard_readers;      // records are sharded by readers, otherwise by the prefetcher
+	size_t m_first_record = 0; // records in files before the current one
+	std::shared_ptr<IOEngine> m_engine;
+	std::unique_ptr<RecordPrefetcher> m_prefetcher;
 };
 
 
@@ -140,28 +450,68 @@ public:
 	RecordYielderRandomized(const RecordYielderRandomized&) = delete; // non construction-copyable
 	RecordYielderRandomized& operator=( const RecordYielderRandomized&) = delete; // non copyable
 
-	explicit RecordYielderRandomized(std::vector<std::string>& filenames, int buffsize, uint64_t seed, int epoch, RecordReader::Compression compression)
+	explicit RecordYielderRandomized(std::vector<std::string>& filenames, int buffsize, uint64_t seed, int epoch, RecordReader::Compression compression, bool advise = false,
+	                                 bool background_inflate = false, int prefetch_depth = 0, int reader_threads = 1, int cycle_length = 1,
+	                                 int block_length = 1, int shard_index = 0, int num_shards = 1, Sharding sharding = ShardFiles,
+	                                 uint64_t buffer_bytes = 0)
 	{
+		CheckShuffleBufferLimits(buffsize, buffer_bytes);
 		m_filenames = filenames;
 		m_compression = compression;
 		m_buffsize = buffsize;
+		m_buffer_bytes = buffer_bytes;
+		m_advise = advise;
+		m_background_inflate = background_inflate;
+		m_shard_index = shard_index;
+		m_num_shards = num_shards;
 		uint64_t hash = ((uint64_t)std::hash<size_t>{}(seed)) ^ ((uint64_t)std::hash<int>{}(epoch) << 1);
 		std::mt19937_64 shuffle_rnd(hash);
 		std::shuffle(m_filenames.begin(), m_filenames.end(), shuffle_rnd);
+		ShardFilenames(m_filenames, shard_index, num_shards, sharding);
 
 		m_current_file = 0;
 		m_rr = nullptr;
 		m_rnd = std::mt19937_64(std::hash<int>{}(hash) ^ ((uint64_t)std::hash<int>{}(seed) << 1));
+
+		// Interleaved files are read by the prefetcher, one thread per open file
+		if (cycle_length > 1 && prefetch_depth <= 0)
+		{
+			prefetch_depth = std::max(block_length, 1);
+		}
+		m_shard_readers = sharding == ShardRecords && prefetch_depth <= 0;
+		if (prefetch_depth > 0)
+		{
+			m_prefetcher.reset(new RecordPrefetcher(m_filenames.size(), [this](size_t file)
+			{
+				return OpenReader(int(file));
+			}, reader_threads, prefetch_depth, cycle_length, std::max(block_length, 1)));
+			if (sharding == ShardRecords)
+			{
+				m_prefetcher->SetSharding(shard_index, num_shards);
+			}
+			m_filler = std::thread(&RecordYielderRandomized::Fill, this);
+		}
 	}
 
 	virtual ~RecordYielderRandomized()
 	{
+		if (m_prefetcher)
+		{
+			m_prefetcher->Stop();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+				m_space_cv.notify_all();
+			}
+			m_filler.join();
+			m_prefetcher.reset();
+		}
 		delete m_rr;
 	}
 
 	void FillBuffer()
 	{
-		while (m_buffer.size() < m_buffsize)
+		while (!ShuffleBufferFull(m_buffer.size(), m_buffered_bytes, m_buffsize, m_buffer_bytes))
 		{
 			if (m_current_file >= m_filenames.size())
 			{
@@ -170,7 +520,7 @@ public:
 
 			if (m_rr == nullptr)
 			{
-				m_rr = new RecordReader(m_filenames[m_current_file], m_compression);
+				m_rr = OpenReader(m_current_file);
 			}
 
 			PyBytesObject* bytesObject = nullptr;
@@ -180,6 +530,7 @@ public:
 			{
 				if (status.is_eof())
 				{
+					m_first_record += m_rr->record_number();
 					delete m_rr;
 					m_rr = nullptr;
 					++m_current_file;
@@ -190,27 +541,48 @@ public:
 					throw runtime_error("Error while iterating RecordReader at offset: %zd", m_rr->offset());
 				}
 			}
+			RecordLocation location = { m_current_file, m_rr->record_offset() };
+			m_buffered_bytes += PyBytes_GET_SIZE(bytesObject);
 			auto index = m_rnd() % (m_buffer.size() + 1);
 			if (index == m_buffer.size())
 			{
 				m_buffer.push_back(py::reinterpret_steal<py::object>((PyObject*) bytesObject));
+				m_locations.push_back(location);
 			}
 			else
 			{
 				m_buffer.push_back(std::move(m_buffer[index]));
 				m_buffer[index] = std::move(py::reinterpret_steal<py::object>((PyObject*) bytesObject));
+				m_locations.push_back(m_locations[index]);
+				m_locations[index] = location;
 			}
 		}
 	}
 
 	py::object GetNext()
 	{
+		if (m_prefetcher)
+		{
+			std::vector<std::string> records;
+			{
+				py::gil_scoped_release release;
+				PopRecords(records, 1);
+			}
+			if (records.empty())
+			{
+				throw py::stop_iteration();
+			}
+			return py::bytes(records[0]);
+		}
+
 		FillBuffer();
 
 		if (!m_buffer.empty())
 		{
 			py::object value = std::move(m_buffer.back());
 			m_buffer.pop_back();
+			m_locations.pop_back();
+			m_buffered_bytes -= PyBytes_GET_SIZE(value.ptr());
 			return std::move(value);
 		}
 		else
@@ -221,6 +593,16 @@ public:
 
 	py::list GetNextN(int n)
 	{
+		if (m_prefetcher)
+		{
+			std::vector<std::string> records;
+			{
+				py::gil_scoped_release release;
+				PopRecords(records, n);
+			}
+			return RecordsToList(records);
+		}
+
 		py::list  batch;
 		for (int i = 0; i < n; ++i)
 		{
@@ -230,6 +612,8 @@ public:
 			{
 				py::object value = std::move(m_buffer.back());
 				m_buffer.pop_back();
+				m_locations.pop_back();
+				m_buffered_bytes -= PyBytes_GET_SIZE(value.ptr());
 				batch.append(std::move(value));
 			}
 			else if(batch.size() > 0)
@@ -244,14 +628,194 @@ public:
 		return std::move(batch);
 	}
 
+	// Memory held by the shuffle buffer, including per record overhead and unused capacity of containers
+	size_t ResidentBytes()
+	{
+		if (m_prefetcher)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			size_t bytes = m_records.capacity() * sizeof(std::string);
+			for (const auto& record: m_records)
+			{
+				bytes += record.capacity() + 1;
+			}
+			return bytes;
+		}
+		size_t bytes = m_buffer.capacity() * sizeof(py::object) + m_locations.capacity() * sizeof(RecordLocation);
+		for (const auto& record: m_buffer)
+		{
+			bytes += offsetof(PyBytesObject, ob_sval) + PyBytes_GET_SIZE(record.ptr()) + 1 + sizeof(uint32_t);
+		}
+		return bytes;
+	}
+
+	py::dict GetState(bool include_buffer)
+	{
+		if (m_prefetcher)
+		{
+			throw runtime_error("Yielder state is not available with prefetching or interleaving");
+		}
+		py::dict state = SavePosition(m_filenames, m_current_file, m_first_record, m_rr, m_rnd, m_locations);
+		if (include_buffer)
+		{
+			py::list buffer;
+			for (const auto& record: m_buffer)
+			{
+				buffer.append(record);
+			}
+			state["buffer"] = buffer;
+		}
+		return state;
+	}
+
+	void SetState(const py::dict& state)
+	{
+		if (m_prefetcher)
+		{
+			throw runtime_error("Yielder state is not available with prefetching or interleaving");
+		}
+		LoadPosition(state, m_filenames, m_current_file, m_first_record, m_rr, m_rnd, [this](int file) { return OpenReader(file); });
+		m_locations = LoadLocations(state, m_filenames.size());
+		m_buffer.clear();
+		m_buffered_bytes = 0;
+
+		if (state.contains("buffer"))
+		{
+			for (auto record: state["buffer"].cast<py::list>())
+			{
+				if (!PyBytes_Check(record.ptr()))
+				{
+					throw runtime_error("Invalid yielder state, buffered records must be bytes");
+				}
+				m_buffer.push_back(py::reinterpret_borrow<py::object>(record));
+				m_buffered_bytes += PyBytes_GET_SIZE(record.ptr());
+			}
+			if (m_buffer.size() != m_locations.size())
+			{
+				throw runtime_error("Invalid yielder state, buffer has %zd records, but %zd locations", m_buffer.size(), m_locations.size());
+			}
+			return;
+		}
+
+		m_buffer.resize(m_locations.size());
+		ReadLocations(m_locations, [this](int file) { return OpenReader(file); }, [this](size_t i, RecordReader* rr, uint64_t offset)
+		{
+			PyBytesObject* bytesObject = nullptr;
+			auto status = rr->ReadRecord(offset, GetBytesAllocator(bytesObject));
+			if (!status.ok() || status.is_eof())
+			{
+				throw runtime_error("Error while reading record at offset: %zd", offset);
+			}
+			m_buffer[i] = py::reinterpret_steal<py::object>((PyObject*) bytesObject);
+			m_buffered_bytes += PyBytes_GET_SIZE(bytesObject);
+		});
+	}
+
 private:
+	RecordReader* OpenReader(int file)
+	{
+		RecordReader* rr = new RecordReader(m_filenames[file], m_compression, RecordReader::Stream,
+		                                    RecordReader::DefaultBlockSize, RecordReader::DefaultIODepth, nullptr, m_advise);
+		if (m_background_inflate)
+		{
+			rr->StartBackgroundInflate();
+		}
+		if (m_shard_readers)
+		{
+			SetRecordSharding(rr, m_shard_index, m_num_shards, m_first_record);
+		}
+		return rr;
+	}
+
+	// Filler thread. Records come from the prefetcher in the same order as they are read by FillBuffer, and the
+	// buffer is refilled only after a record is taken from a full buffer, so records are shuffled the same way.
+	void Fill()
+	{
+		std::string error;
+		try
+		{
+			std::string record;
+			while (m_prefetcher->Next(record))
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_space_cv.wait(lock, [this] { return m_stop || !ShuffleBufferFull(m_records.size(), m_buffered_bytes, m_buffsize, m_buffer_bytes); });
+				if (m_stop)
+				{
+					return;
+				}
+				m_buffered_bytes += record.size();
+				auto index = m_rnd() % (m_records.size() + 1);
+				if (index == m_records.size())
+				{
+					m_records.push_back(std::move(record));
+				}
+				else
+				{
+					m_records.push_back(std::move(m_records[index]));
+					m_records[index] = std::move(record);
+				}
+				m_ready_cv.notify_all();
+			}
+		}
+		catch (const std::exception& e)
+		{
+			error = e.what();
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_error = std::move(error);
+		m_source_done = true;
+		m_ready_cv.notify_all();
+	}
+
+	// Takes up to `n` records, once the buffer is full or all files are read
+	void PopRecords(std::vector<std::string>& records, int n)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (int(records.size()) < n)
+		{
+			m_ready_cv.wait(lock, [this] { return m_source_done || ShuffleBufferFull(m_records.size(), m_buffered_bytes, m_buffsize, m_buffer_bytes); });
+			if (!m_error.empty())
+			{
+				throw runtime_error("%s", m_error.c_str());
+			}
+			if (m_records.empty())
+			{
+				return;
+			}
+			m_buffered_bytes -= m_records.back().size();
+			records.push_back(std::move(m_records.back()));
+			m_records.pop_back();
+			m_space_cv.notify_all();
+		}
+	}
+
 	std::mt19937_64 m_rnd;
 	std::vector<std::string> m_filenames;
 	RecordReader::Compression m_compression;
 	std::vector<py::object> m_buffer;
 	int m_buffsize;
+	uint64_t m_buffer_bytes;
+	uint64_t m_buffered_bytes = 0; // payload bytes in the buffer, m_buffer or m_records
+	bool m_advise;
+	bool m_background_inflate;
+	int m_shard_index;
+	int m_num_shards;
+	bool m_shard_readers;      // records are sharded by readers, otherwise by the prefetcher
+	size_t m_first_record = 0; // records in files before the current one
 	RecordReader* m_rr;
 	int m_current_file;
+	std::vector<RecordLocation> m_locations; // where records of m_buffer were read from
+
+	// Prefetching. The shuffle buffer holds records as strings and is filled by the filler thread
+	std::unique_ptr<RecordPrefetcher> m_prefetcher;
+	std::thread m_filler;
+	std::mutex m_mutex;
+	std::condition_variable m_ready_cv;
+	std::condition_variable m_space_cv;
+	std::vector<std::string> m_records;
+	bool m_source_done = false;
+	bool m_stop = false;
+	std::string m_error;
 };
 
 
@@ -261,16 +825,27 @@ public:
 	ParsedRecordYielderRandomized(const ParsedRecordYielderRandomized&) = delete; // non construction-copyable
 	ParsedRecordYielderRandomized& operator=( const ParsedRecordYielderRandomized&) = delete; // non copyable
 
-	explicit ParsedRecordYielderRandomized(py::object parser, std::vector<std::string>& filenames, int buffsize, uint64_t seed, int epoch, RecordReader::Compression compression)
+	explicit ParsedRecordYielderRandomized(py::object parser, std::vector<std::string>& filenames, int buffsize, uint64_t seed, int epoch, RecordReader::Compression compression, bool advise = false,
+	                                       bool background_inflate = false, int shard_index = 0, int num_shards = 1, Sharding sharding = ShardFiles,
+	                                       uint64_t buffer_bytes = 0, uint64_t slab_size = RecordArena::MaxSlabSize):
+		m_arena(slab_size), m_slab_size(slab_size)
 	{
+		CheckShuffleBufferLimits(buffsize, buffer_bytes);
 		m_parser_obj = parser;
 		m_parser = py::cast<Records::RecordParser*>(m_parser_obj);
 		m_filenames = filenames;
 		m_compression = compression;
 		m_buffsize = buffsize;
+		m_buffer_bytes = buffer_bytes;
+		m_advise = advise;
+		m_background_inflate = background_inflate;
+		m_shard_index = shard_index;
+		m_num_shards = num_shards;
+		m_sharding = sharding;
 		uint64_t hash = ((uint64_t)std::hash<size_t>{}(seed)) ^ ((uint64_t)std::hash<int>{}(epoch) << 1);
 		std::mt19937_64 shuffle_rnd(hash);
 		std::shuffle(m_filenames.begin(), m_filenames.end(), shuffle_rnd);
+		ShardFilenames(m_filenames, shard_index, num_shards, sharding);
 
 		m_current_file = 0;
 		m_rr = nullptr;
@@ -284,7 +859,7 @@ public:
 
 	void FillBuffer()
 	{
-		while (m_buffer.size() < m_buffsize)
+		while (!ShuffleBufferFull(m_buffer.size(), m_buffered_bytes, m_buffsize, m_buffer_bytes))
 		{
 			if (m_current_file >= m_filenames.size())
 			{
@@ -293,20 +868,20 @@ public:
 
 			if (m_rr == nullptr)
 			{
-				m_rr = new RecordReader(m_filenames[m_current_file], m_compression);
+				m_rr = OpenReader(m_current_file);
 			}
 
-			std::string str;
-			auto alloc = [&str](size_t size)
+			RecordArena::Handle handle;
+			auto alloc = [this, &handle](size_t size)
 			{
-				str.resize(size + sizeof(uint32_t));
-				return &str[0];
+				return m_arena.Allocate(size + sizeof(uint32_t), handle);
 			};
 			auto status = m_rr->GetNext(alloc);
 			if (!status.ok() || status.is_eof())
 			{
 				if (status.is_eof())
 				{
+					m_first_record += m_rr->record_number();
 					delete m_rr;
 					m_rr = nullptr;
 					++m_current_file;
@@ -317,28 +892,35 @@ public:
 					throw runtime_error("Error while iterating RecordReader at offset: %zd", m_rr->offset());
 				}
 			}
+			BufferedRecord record = { handle, m_rr->record_compression(), { m_current_file, m_rr->record_offset() } };
+			m_buffered_bytes += handle.size - sizeof(uint32_t);
 			auto index = m_rnd() % (m_buffer.size() + 1);
 			if (index == m_buffer.size())
 			{
-				m_buffer.push_back(std::move(str));
+				m_buffer.push_back(record);
 			}
 			else
 			{
-				m_buffer.push_back(std::move(m_buffer[index]));
-				m_buffer[index] = std::move(str);
+				m_buffer.push_back(m_buffer[index]);
+				m_buffer[index] = record;
 			}
 		}
 	}
 
 	py::object GetNext()
 	{
+		CompactBuffer();
 		FillBuffer();
 
 		if (!m_buffer.empty())
 		{
-			std::string value = std::move(m_buffer.back());
+			BufferedRecord record = m_buffer.back();
 			m_buffer.pop_back();
-			return m_parser->ParseSingleExample(value);
+			m_buffered_bytes -= record.handle.size - sizeof(uint32_t);
+			std::string decompressed;
+			py::object example = m_parser->ParseSingleExampleView(View(record, decompressed));
+			m_arena.Free(record.handle);
+			return example;
 		}
 		else
 		{
@@ -348,37 +930,555 @@ public:
 
 	py::list GetNextN(int n)
 	{
-		std::vector<std::string>  batch;
+		// Taken records are freed only after parsing, so filling the buffer meanwhile does not overwrite them
+		CompactBuffer();
+		std::vector<BufferedRecord> records;
 		for (int i = 0; i < n; ++i)
 		{
 			FillBuffer();
 
 			if (!m_buffer.empty())
 			{
-				std::string value = std::move(m_buffer.back());
+				records.push_back(m_buffer.back());
 				m_buffer.pop_back();
-				batch.push_back(std::move(value));
+				m_buffered_bytes -= records.back().handle.size - sizeof(uint32_t);
 			}
-			else if(batch.size() > 0)
+			else if(records.empty())
 			{
-				return m_parser->ParseExample(batch);
+				throw py::stop_iteration();
 			}
 			else
 			{
-				throw py::stop_iteration();
+				break;
 			}
 		}
-		return std::move(m_parser->ParseExample(batch));
+
+		std::vector<std::string> decompressed(records.size());
+		std::vector<Records::ExampleView> views(records.size());
+		std::string error;
+		std::mutex error_mutex;
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < int(records.size()); ++i)
+		{
+			try
+			{
+				views[i] = View(records[i], decompressed[i]);
+			}
+			catch (const std::exception& e)
+			{
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (error.empty())
+				{
+					error = e.what();
+				}
+			}
+		}
+		if (!error.empty())
+		{
+			throw runtime_error("%s", error.c_str());
+		}
+
+		py::list batch = m_parser->ParseExampleViews(views);
+		for (const auto& record: records)
+		{
+			m_arena.Free(record.handle);
+		}
+		return batch;
+	}
+
+	// Slabs of the arena, which include records taken but not yet freed and empty slabs kept for reuse
+	size_t ResidentBytes() const
+	{
+		return m_arena.reserved_bytes() + m_buffer.capacity() * sizeof(BufferedRecord);
+	}
+
+	py::dict GetState(bool include_buffer)
+	{
+		std::vector<RecordLocation> locations;
+		for (const auto& record: m_buffer)
+		{
+			locations.push_back(record.location);
+		}
+		py::dict state = SavePosition(m_filenames, m_current_file, m_first_record, m_rr, m_rnd, locations);
+		if (include_buffer)
+		{
+			// Payloads are saved as stored, individually compressed records stay compressed
+			py::list buffer;
+			py::list compression;
+			for (const auto& record: m_buffer)
+			{
+				buffer.append(py::bytes((const char*)m_arena.data(record.handle), record.handle.size - sizeof(uint32_t)));
+				compression.append(int(record.compression));
+			}
+			state["buffer"] = buffer;
+			state["buffer_compression"] = compression;
+		}
+		return state;
+	}
+
+	void SetState(const py::dict& state)
+	{
+		LoadPosition(state, m_filenames, m_current_file, m_first_record, m_rr, m_rnd, [this](int file) { return OpenReader(file); });
+		std::vector<RecordLocation> locations = LoadLocations(state, m_filenames.size());
+		m_buffer.clear();
+		m_arena = RecordArena(m_slab_size);
+		m_buffered_bytes = 0;
+		m_buffer.resize(locations.size());
+		for (size_t i = 0; i < locations.size(); ++i)
+		{
+			m_buffer[i].location = locations[i];
+		}
+
+		if (state.contains("buffer"))
+		{
+			auto buffer = state["buffer"].cast<py::list>();
+			auto compression = state["buffer_compression"].cast<py::list>();
+			if (buffer.size() != m_buffer.size() || compression.size() != m_buffer.size())
+			{
+				throw runtime_error("Invalid yielder state, buffer has %zd records, but %zd locations", buffer.size(), m_buffer.size());
+			}
+			for (size_t i = 0; i < m_buffer.size(); ++i)
+			{
+				std::string data = buffer[i].cast<std::string>();
+				memcpy(m_arena.Allocate(data.size() + sizeof(uint32_t), m_buffer[i].handle), data.data(), data.size());
+				m_buffered_bytes += data.size();
+				m_buffer[i].compression = RecordCompression(compression[i].cast<int>());
+			}
+			return;
+		}
+
+		ReadLocations(locations, [this](int file) { return OpenReader(file); }, [this](size_t i, RecordReader* rr, uint64_t offset)
+		{
+			BufferedRecord& record = m_buffer[i];
+			auto status = rr->ReadRecord(offset, [this, &record](size_t size)
+			{
+				return m_arena.Allocate(size + sizeof(uint32_t), record.handle);
+			});
+			if (!status.ok() || status.is_eof())
+			{
+				throw runtime_error("Error while reading record at offset: %zd", offset);
+			}
+			record.compression = rr->record_compression();
+			m_buffered_bytes += record.handle.size - sizeof(uint32_t);
+		});
 	}
 
 private:
+	// Record in the arena, stored payload is followed by sizeof(uint32_t) bytes of padding
+	struct BufferedRecord
+	{
+		RecordArena::Handle handle;
+		RecordCompression compression;
+		RecordLocation location;
+	};
+
+	// Returns payload of the record, decompressing it to `decompressed` if needed
+	Records::ExampleView View(const BufferedRecord& record, std::string& decompressed) const
+	{
+		const uint8_t* payload = m_arena.data(record.handle);
+		size_t size = record.handle.size - sizeof(uint32_t);
+		if (record.compression == RecordUncompressed)
+		{
+			return { payload, size };
+		}
+		decompressed.resize(GetUncompressedSize(record.compression, payload, size) + sizeof(uint32_t));
+		DecompressRecord(record.compression, payload, size, (uint8_t*)&decompressed[0]);
+		return { (const uint8_t*)decompressed.data(), decompressed.size() - sizeof(uint32_t) };
+	}
+
+	// Records are taken out of the buffer at random, which leaves slabs of the arena partially used
+	void CompactBuffer()
+	{
+		if (m_arena.fragmented())
+		{
+			m_arena.Compact(m_buffer, &BufferedRecord::handle);
+		}
+	}
+
+	RecordReader* OpenReader(int file)
+	{
+		RecordReader* rr = new RecordReader(m_filenames[file], m_compression, RecordReader::Stream,
+		                                    RecordReader::DefaultBlockSize, RecordReader::DefaultIODepth, nullptr, m_advise);
+		if (m_background_inflate)
+		{
+			rr->StartBackgroundInflate();
+		}
+		// Individually compressed records are kept compressed in the buffer, and decompressed in parallel
+		// when a batch is taken
+		rr->SetRecordDecompression(false);
+		if (m_sharding == ShardRecords)
+		{
+			SetRecordSharding(rr, m_shard_index, m_num_shards, m_first_record);
+		}
+		return rr;
+	}
+
 	std::mt19937_64 m_rnd;
 	std::vector<std::string> m_filenames;
 	RecordReader::Compression m_compression;
-	std::vector<std::string> m_buffer;
+	std::vector<BufferedRecord> m_buffer;
+	RecordArena m_arena;
+	uint64_t m_slab_size;
 	int m_buffsize;
+	uint64_t m_buffer_bytes;
+	uint64_t m_buffered_bytes = 0; // payload bytes in the buffer
+	bool m_advise;
+	bool m_background_inflate;
+	int m_shard_index;
+	int m_num_shards;
+	Sharding m_sharding;
+	size_t m_first_record = 0; // records in files before the current one
 	RecordReader* m_rr;
 	int m_current_file;
 	py::object m_parser_obj;
 	Records::RecordParser* m_parser;
 };
+
+
+// Mixes records of several datasets. Each source is a RecordYielderRandomized with its own readers and shuffle buffer,
+// and every record is drawn from a source chosen at random according to the weights.
+class HIDDEN RecordYielderMixture
+{
+public:
+	RecordYielderMixture(const RecordYielderMixture&) = delete; // non construction-copyable
+	RecordYielderMixture& operator=( const RecordYielderMixture&) = delete; // non copyable
+
+	explicit RecordYielderMixture(std::vector<std::vector<std::string> >& sources, const std::vector<double>& weights, int buffsize, uint64_t seed, int epoch,
+	                              RecordReader::Compression compression, bool restart = false, uint64_t buffer_bytes = 0)
+	{
+		if (sources.size() != weights.size())
+		{
+			throw runtime_error("Number of weights %zd does not match number of sources %zd", weights.size(), sources.size());
+		}
+		double total = 0.0;
+		for (double weight: weights)
+		{
+			if (!(weight >= 0.0))
+			{
+				throw runtime_error("Weights of sources must not be negative");
+			}
+			total += weight;
+		}
+		if (total <= 0.0)
+		{
+			throw runtime_error("At least one source must have a positive weight");
+		}
+		CheckShuffleBufferLimits(buffsize, buffer_bytes);
+
+		m_sources = sources;
+		m_weights = weights;
+		m_buffsize = buffsize;
+		m_buffer_bytes = buffer_bytes;
+		m_seed = seed;
+		m_epoch = epoch;
+		m_compression = compression;
+		m_restart = restart;
+		m_yielders.resize(m_sources.size());
+		m_passes.resize(m_sources.size(), 0);
+		m_yielded.resize(m_sources.size(), false);
+		for (size_t i = 0; i < m_sources.size(); ++i)
+		{
+			if (m_weights[i] > 0.0)
+			{
+				OpenSource(i);
+			}
+		}
+		uint64_t hash = ((uint64_t)std::hash<size_t>{}(seed)) ^ ((uint64_t)std::hash<int>{}(epoch) << 1);
+		m_rnd = std::mt19937_64(hash);
+		UpdateDistribution();
+	}
+
+	py::object GetNext()
+	{
+		while (m_active > 0)
+		{
+			size_t source = m_distribution(m_rnd);
+			try
+			{
+				py::object record = m_yielders[source]->GetNext();
+				m_yielded[source] = true;
+				return record;
+			}
+			catch (const py::stop_iteration&)
+			{
+				SourceExhausted(source);
+			}
+		}
+		throw py::stop_iteration();
+	}
+
+	py::list GetNextN(int n)
+	{
+		py::list batch;
+		for (int i = 0; i < n; ++i)
+		{
+			try
+			{
+				batch.append(GetNext());
+			}
+			catch (const py::stop_iteration&)
+			{
+				if (batch.size() == 0)
+				{
+					throw;
+				}
+				break;
+			}
+		}
+		return batch;
+	}
+
+private:
+	// Each pass over a source is shuffled as the next epoch of that source
+	void OpenSource(size_t source)
+	{
+		m_yielders[source].reset(new RecordYielderRandomized(m_sources[source], m_buffsize, m_seed + source, m_epoch + m_passes[source],
+		                                                     m_compression, false, false,
+		                                                     0, 1,              // no prefetching
+		                                                     1, 1,              // no interleaving
+		                                                     0, 1, ShardFiles,  // no sharding
+		                                                     m_buffer_bytes));
+	}
+
+	void SourceExhausted(size_t source)
+	{
+		// Source that yields nothing in a whole pass is dropped even with restarts, which would never end otherwise
+		bool yielded = m_yielded[source];
+		m_yielded[source] = false;
+		if (m_restart && yielded)
+		{
+			++m_passes[source];
+			OpenSource(source);
+			return;
+		}
+		m_yielders[source].reset();
+		UpdateDistribution();
+	}
+
+	void UpdateDistribution()
+	{
+		std::vector<double> weights(m_weights.size(), 0.0);
+		m_active = 0;
+		for (size_t i = 0; i < m_weights.size(); ++i)
+		{
+			if (m_yielders[i])
+			{
+				weights[i] = m_weights[i];
+				++m_active;
+			}
+		}
+		if (m_active > 0)
+		{
+			m_distribution = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+		}
+	}
+
+	std::vector<std::vector<std::string> > m_sources;
+	std::vector<double> m_weights;
+	std::vector<std::unique_ptr<RecordYielderRandomized> > m_yielders; // nullptr for exhausted sources
+	std::vector<int> m_passes;
+	std::vector<bool> m_yielded; // source yielded a record in the current pass
+	std::discrete_distribution<size_t> m_distribution;
+	std::mt19937_64 m_rnd;
+	size_t m_active = 0;
+	int m_buffsize;
+	uint64_t m_buffer_bytes;
+	uint64_t m_seed;
+	int m_epoch;
+	RecordReader::Compression m_compression;
+	bool m_restart;
+};
+
+
+// Shuffles all records of the dataset, instead of the records that fit in a shuffle buffer. Record indices give the
+// (file, offset) of every record, which are split into blocks of `block_size` consecutive records of a file. Order of
+// blocks is shuffled, then records of each `window` consecutive blocks are shuffled together. Records of a window are
+// read block by block, in order of offsets, so reads stay mostly sequential.
+// Windows are read in the planned order by a background thread, up to `prefetch_windows` ahead of the consumer.
+class HIDDEN RecordYielderGlobalShuffle
+{
+public:
+	RecordYielderGlobalShuffle(const RecordYielderGlobalShuffle&) = delete; // non construction-copyable
+	RecordYielderGlobalShuffle& operator=( const RecordYielderGlobalShuffle&) = delete; // non copyable
+
+	explicit RecordYielderGlobalShuffle(const std::vector<std::string>& filenames, uint64_t seed, int epoch, RecordReader::Compression compression,
+	                                    int block_size = 64, int window = 16, int prefetch_windows = 2, int max_open_files = 16,
+	                                    int threads = 8, bool save_index = true, int shard_index = 0, int num_shards = 1)
+	{
+		if (num_shards < 1 || shard_index < 0 || shard_index >= num_shards)
+		{
+			throw runtime_error("Shard index %d is out of range, number of shards is %d", shard_index, num_shards);
+		}
+		m_window = std::max(window, 1);
+		m_prefetch_windows = size_t(std::max(prefetch_windows, 1));
+
+		// File order is not shuffled, global record numbers must not depend on the epoch
+		m_dataset.reset(new RecordDataset(filenames, compression, RecordReader::Stream, std::max(max_open_files, 1), threads, save_index));
+
+		size_t block = size_t(std::max(block_size, 1));
+		std::vector<Block> blocks;
+		for (int i = 0; i < m_dataset->file_count(); ++i)
+		{
+			size_t end = m_dataset->first_record(i + 1);
+			for (size_t first = m_dataset->first_record(i); first < end; first += block)
+			{
+				blocks.push_back({ first, std::min(block, end - first) });
+			}
+		}
+
+		uint64_t hash = ((uint64_t)std::hash<size_t>{}(seed)) ^ ((uint64_t)std::hash<int>{}(epoch) << 1);
+		std::mt19937_64 shuffle_rnd(hash);
+		std::shuffle(blocks.begin(), blocks.end(), shuffle_rnd);
+
+		// Blocks are split between shards after the shuffle, so all workers agree on the split of each epoch
+		for (size_t i = shard_index; i < blocks.size(); i += num_shards)
+		{
+			m_blocks.push_back(blocks[i]);
+			m_size += blocks[i].count;
+		}
+
+		m_rnd = std::mt19937_64(std::hash<int>{}(hash) ^ ((uint64_t)std::hash<int>{}(seed) << 1));
+		m_reader = std::thread(&RecordYielderGlobalShuffle::Read, this);
+	}
+
+	virtual ~RecordYielderGlobalShuffle()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+			m_space_cv.notify_all();
+		}
+		m_reader.join();
+	}
+
+	// Number of records yielded in the epoch, by this shard
+	size_t size() const { return m_size; }
+
+	py::object GetNext()
+	{
+		std::vector<std::string> records;
+		{
+			py::gil_scoped_release release;
+			PopRecords(records, 1);
+		}
+		if (records.empty())
+		{
+			throw py::stop_iteration();
+		}
+		return py::bytes(records[0]);
+	}
+
+	py::list GetNextN(int n)
+	{
+		std::vector<std::string> records;
+		{
+			py::gil_scoped_release release;
+			PopRecords(records, n);
+		}
+		return RecordsToList(records);
+	}
+
+private:
+	struct Block
+	{
+		size_t first; // global number of the first record
+		size_t count;
+	};
+
+	// Reader thread. Windows are shuffled here, in order, so the order of records depends only on seed and epoch
+	void Read()
+	{
+		std::string error;
+		try
+		{
+			for (size_t begin = 0; begin < m_blocks.size(); begin += m_window)
+			{
+				size_t end = std::min(begin + m_window, m_blocks.size());
+				std::vector<size_t> numbers;
+				for (size_t i = begin; i < end; ++i)
+				{
+					for (size_t k = 0; k < m_blocks[i].count; ++k)
+					{
+						numbers.push_back(m_blocks[i].first + k);
+					}
+				}
+				std::shuffle(numbers.begin(), numbers.end(), m_rnd);
+
+				std::vector<std::string> records(numbers.size());
+				std::vector<size_t> sizes(numbers.size());
+				m_dataset->ReadRecords(numbers, [&records, &sizes](size_t i, size_t size)
+				{
+					sizes[i] = size;
+					records[i].resize(size + sizeof(uint32_t));
+					return &records[i][0];
+				});
+				for (size_t i = 0; i < records.size(); ++i)
+				{
+					records[i].resize(sizes[i]);
+				}
+				// Records are taken from the back
+				std::reverse(records.begin(), records.end());
+
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_space_cv.wait(lock, [this] { return m_stop || m_windows.size() < m_prefetch_windows; });
+				if (m_stop)
+				{
+					return;
+				}
+				m_windows.push_back(std::move(records));
+				m_ready_cv.notify_all();
+			}
+		}
+		catch (const std::exception& e)
+		{
+			error = e.what();
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_error = std::move(error);
+		m_done = true;
+		m_ready_cv.notify_all();
+	}
+
+	// Takes up to `n` records in the planned order, waiting for windows that are not read yet
+	void PopRecords(std::vector<std::string>& records, int n)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (int(records.size()) < n)
+		{
+			m_ready_cv.wait(lock, [this] { return m_done || !m_windows.empty(); });
+			if (m_windows.empty())
+			{
+				if (!m_error.empty())
+				{
+					throw runtime_error("%s", m_error.c_str());
+				}
+				return;
+			}
+			std::vector<std::string>& window = m_windows.front();
+			records.push_back(std::move(window.back()));
+			window.pop_back();
+			if (window.empty())
+			{
+				m_windows.pop_front();
+				m_space_cv.notify_all();
+			}
+		}
+	}
+
+	std::unique_ptr<RecordDataset> m_dataset;
+	std::vector<Block> m_blocks; // blocks of this shard, in the shuffled order
+	size_t m_size = 0;
+	size_t m_window;
+	size_t m_prefetch_windows;
+	std::mt19937_64 m_rnd;      // used by the reader thread only
+
+	std::thread m_reader;
+	std::mutex m_mutex;
+	std::condition_variable m_ready_cv;
+	std::condition_variable m_space_cv;
+	std::deque<std::vector<std::string> > m_windows;
+	bool m_done = false;
+	bool m_stop = false;
+	std::string m_error;
+};
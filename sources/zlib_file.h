@@ -4,27 +4,58 @@
 
 #include <cstdio>
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <mutex>
 #include <string.h>
 #include "zlib.h"
 #include "common.h"
+#include "record_index.h"
 
 
 namespace fsal
 {
+	// Inflate state at a deflate block boundary, from which decompression can be resumed without decompressing
+	// everything before it (same approach as zran.c from zlib examples). Raw deflate is resumed at `in_offset` of the
+	// compressed file, with `bits` bits of the previous byte (`prime`) and the last 32KiB of output as a dictionary.
+	struct InflateCheckpoint
+	{
+		uint64_t out_offset;
+		uint64_t in_offset;
+		uint8_t bits;
+		uint8_t prime;
+		std::vector<uint8_t> window;
+	};
+
+	// Start of a member of a multi-member gzip file (or of a stream in concatenated zlib streams)
+	struct InflateMember
+	{
+		uint64_t out_offset;
+		uint64_t in_offset;
+	};
+
 	class ZlibFile : public FileInterface
 	{
 		enum
 		{
 			buff_size = 256 * 1024,
-			buff_real_size = buff_size * 8
+			buff_real_size = buff_size * 8,
+			direct_threshold = 32 * 1024,
+			parallel_batch_min = 1024 * 1024,
+			parallel_batch_max = 32 * 1024 * 1024
 		};
 
 	public:
+		enum
+		{
+			DefaultCheckpointInterval = 1024 * 1024
+		};
+
 		ZlibFile(const std::shared_ptr<FileInterface>& compressed, int window = MAX_WBITS)
 		{
 			m_file = compressed;
-			m_input_buff.reset(new uint8_t[buff_real_size]);
-			m_output_buff.reset(new uint8_t[buff_real_size]);
+			m_input_buff.reset(new uint8_t[buff_real_size], std::default_delete<uint8_t[]>());
+			m_output_buff.reset(new uint8_t[buff_real_size], std::default_delete<uint8_t[]>());
 			m_inputbuff_begin = 0;
 			m_inputbuff_end = 0;
 			m_outputbuff_begin = 0;
@@ -34,18 +65,23 @@ namespace fsal
 			m_dst_offset = 0;
 			m_window = window;
 
-            m_stream.zalloc = Z_NULL;
+			m_stream.zalloc = Z_NULL;
 			m_stream.zfree = Z_NULL;
 			m_stream.opaque = Z_NULL;
 			m_stream.next_in = Z_NULL;
 			m_stream.avail_in = 0;
 
-            int status = inflateInit2(&m_stream, m_window);
+			int status = inflateInit2(&m_stream, m_window);
 			if (status != Z_OK)
 				throw runtime_error("Failed to init zlib");
+
+			m_members.push_back({0, 0});
 		}
 
-		~ZlibFile() {};
+		~ZlibFile()
+		{
+			inflateEnd(&m_stream);
+		}
 
 		bool ok() const { return m_file != nullptr; }
 
@@ -74,13 +110,22 @@ namespace fsal
 				}
 				if (size == 0)
 					return Status::kOk;
-				if (m_inputbuff_end + buff_size >= buff_real_size)
+
+				if (dst != nullptr && size >= direct_threshold)
 				{
-					memmove(m_input_buff.get(), m_input_buff.get() + m_inputbuff_begin,
-					       m_inputbuff_end - m_inputbuff_begin);
-					m_inputbuff_end -= m_inputbuff_begin;
-					m_inputbuff_begin = 0;
+					// Large reads are inflated straight to the destination, output buffer is used only for the tail
+					m_outputbuff_begin = 0;
+					m_outputbuff_end = 0;
+					size_t inflated = Inflate(dst, size);
+					if (inflated == 0)
+						return Status::kEOF;
+					dst += inflated;
+					size -= inflated;
+					*bytesRead += inflated;
+					m_dst_offset += inflated;
+					continue;
 				}
+
 				if (m_outputbuff_end + buff_size >= buff_real_size)
 				{
 					memmove(m_output_buff.get(), m_output_buff.get() + m_outputbuff_begin,
@@ -88,74 +133,48 @@ namespace fsal
 					m_outputbuff_end -= m_outputbuff_begin;
 					m_outputbuff_begin = 0;
 				}
-				size_t bytes_to_read = std::min(m_src_size - m_src_offset, size_t(buff_size));
-				size_t _bytesRead = bytes_to_read;
-				Status status = m_file->ReadData(m_input_buff.get() + m_inputbuff_end, bytes_to_read, &_bytesRead);
-				m_inputbuff_end += _bytesRead;
-				m_src_offset += _bytesRead;
-
-				m_stream.next_in = m_input_buff.get() + m_inputbuff_begin;
-				m_stream.next_out = m_output_buff.get() + m_outputbuff_end;
-				m_stream.avail_in = m_inputbuff_end - m_inputbuff_begin;
-				m_stream.avail_out = buff_size;
-
-				int result = inflate(&m_stream, Z_NO_FLUSH);
-				if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
-				{
-					throw runtime_error("Inflate failed: %s", m_stream.msg);
-				}
-				m_outputbuff_end = m_stream.next_out - m_output_buff.get();
-				m_inputbuff_begin = m_stream.next_in - m_input_buff.get();
-
-				if (m_src_offset == m_src_size && m_outputbuff_end == m_outputbuff_begin && m_inputbuff_end == m_inputbuff_begin)
-				{
+				size_t inflated = Inflate(m_output_buff.get() + m_outputbuff_end, buff_size);
+				if (inflated == 0)
 					return Status::kEOF;
-				}
+				m_outputbuff_end += inflated;
 			}
+			return Status::kOk;
 		}
 
 		Status WriteData(const uint8_t* src, size_t size) { return Status::kFailed; }
 
 		Status _SetPosition(size_t position)
 		{
-			if (position > m_dst_offset)
-			{
-				size_t _bytesRead;
-				ReadData(nullptr, position - m_dst_offset, &_bytesRead);
+			if (position == m_dst_offset)
+				return Status::kOk;
 
-				if (position != m_dst_offset)
-					return Status::kFailed;
+			// Data that was already consumed, but is still in the output buffer
+			if (position < m_dst_offset && m_dst_offset - position <= m_outputbuff_begin)
+			{
+				m_outputbuff_begin -= m_dst_offset - position;
+				m_dst_offset = position;
 				return Status::kOk;
 			}
 
-            inflateEnd(&m_stream);
-
-            m_stream.zalloc = Z_NULL;
-			m_stream.zfree = Z_NULL;
-			m_stream.opaque = Z_NULL;
-			m_stream.next_in = Z_NULL;
-			m_stream.avail_in = 0;
-			m_inputbuff_begin = 0;
-			m_inputbuff_end = 0;
-			m_outputbuff_begin = 0;
-			m_outputbuff_end = 0;
-			m_src_offset = 0;
-			m_dst_offset = 0;
-			m_file->SetPosition(0);
-
-            int status = inflateInit2(&m_stream, m_window);
-			if (status != Z_OK)
-				throw runtime_error("Failed to init zlib");
+			// Resume from the closest checkpoint, unless going forward from the current position is cheaper
+			const InflateCheckpoint* checkpoint = FindCheckpoint(position);
+			uint64_t decoded = m_dst_offset + (m_outputbuff_end - m_outputbuff_begin) + (m_batch_end - m_batch_begin);
+			if (position < m_dst_offset || (checkpoint != nullptr && checkpoint->out_offset > decoded))
+			{
+				if (checkpoint != nullptr)
+					Restore(*checkpoint);
+				else
+					Restart();
+			}
 
-			if (position != 0)
+			if (position != m_dst_offset)
 			{
 				size_t _bytesRead;
-				ReadData(nullptr, position, &_bytesRead);
+				ReadData(nullptr, position - m_dst_offset, &_bytesRead);
 
-				if (_bytesRead != position)
+				if (position != m_dst_offset)
 					return Status::kFailed;
 			}
-
 			return Status::kOk;
 		}
 
@@ -178,13 +197,470 @@ namespace fsal
 
 		bool Resize(size_t newSize) { return false; }
 
+		// Checkpoints are recorded while decompressing, at least `interval` bytes of uncompressed data apart.
+		// Zero disables recording.
+		void SetCheckpointInterval(size_t interval) { m_checkpoint_interval = interval; }
+
+		// True if the whole file was decompressed, so that checkpoints cover all of it
+		bool CheckpointsComplete() const { return m_checkpoints_complete; }
+
+		const std::vector<InflateCheckpoint>& checkpoints() const { return m_checkpoints; }
+
+		// Members are independent streams, so once their boundaries are known, runs of whole members are inflated
+		// concurrently by `threads` threads. Boundaries are recorded while decompressing the whole file, or loaded with
+		// checkpoints. Until then, and for files that consist of a single member, data is inflated by the calling
+		// thread as usual. Zero disables parallel inflate.
+		// Runs start at 1MiB of decompressed data after each seek and grow up to 32MiB while reading sequentially, so
+		// that random access does not inflate much more than it needs.
+		void SetParallelInflate(int threads) { m_parallel_threads = std::max(threads, 0); }
+
+		// True if boundaries of all members are known
+		bool MembersComplete() const { return m_members_complete; }
+
+		// Starts of the members, followed by the end of the file
+		const std::vector<InflateMember>& members() const { return m_members; }
+
+		static std::string SidecarPath(const std::string& filename)
+		{
+			return filename + ".zindex";
+		}
+
+		// Loads checkpoints saved by SaveCheckpoints. `file_size` and `mtime` of the compressed file must match the
+		// saved ones.
+		bool LoadCheckpoints(const std::string& filename, uint64_t file_size, uint64_t mtime)
+		{
+			FILE* fp = std::fopen(filename.c_str(), "rb");
+			if (!fp)
+				return false;
+
+			CheckpointsHeader header = { 0 };
+			bool ok = std::fread(&header, sizeof(header), 1, fp) == 1;
+			ok = ok && header.magic == kCheckpointsMagic && header.version == kCheckpointsVersion;
+			ok = ok && header.file_size == file_size && header.mtime == mtime && header.window == m_window;
+
+			std::vector<InflateCheckpoint> checkpoints;
+			for (uint64_t i = 0; ok && i < header.entries; ++i)
+			{
+				CheckpointEntry entry = { 0 };
+				ok = std::fread(&entry, sizeof(entry), 1, fp) == 1 && entry.window_size <= 32768;
+				if (ok)
+				{
+					InflateCheckpoint checkpoint;
+					checkpoint.out_offset = entry.out_offset;
+					checkpoint.in_offset = entry.in_offset;
+					checkpoint.bits = entry.bits;
+					checkpoint.prime = entry.prime;
+					checkpoint.window.resize(entry.window_size);
+					ok = std::fread(checkpoint.window.data(), 1, entry.window_size, fp) == entry.window_size;
+					checkpoints.push_back(std::move(checkpoint));
+				}
+			}
+
+			std::vector<InflateMember> members;
+			for (uint64_t i = 0; ok && i < header.members; ++i)
+			{
+				InflateMember member = { 0 };
+				ok = std::fread(&member, sizeof(member), 1, fp) == 1;
+				ok = ok && (members.empty() ? member.in_offset == 0 && member.out_offset == 0 :
+				            member.in_offset > members.back().in_offset && member.out_offset >= members.back().out_offset);
+				members.push_back(member);
+			}
+			ok = ok && (members.empty() || members.back().in_offset == file_size);
+			// Nothing may follow the last member, otherwise the file is not what the header describes
+			ok = ok && std::fgetc(fp) == EOF;
+			std::fclose(fp);
+
+			if (ok)
+			{
+				m_checkpoints = std::move(checkpoints);
+				m_checkpoints_complete = true;
+				if (!members.empty())
+				{
+					m_members = std::move(members);
+					m_members_complete = true;
+				}
+			}
+			return ok;
+		}
+
+		bool SaveCheckpoints(const std::string& filename, uint64_t file_size, uint64_t mtime) const
+		{
+			// Write to a temporary file first, so that concurrent readers never observe a partially written file
+			std::string tmp_filename = TemporarySidecarPath(filename);
+			FILE* fp = std::fopen(tmp_filename.c_str(), "wb");
+			if (!fp)
+				return false;
+
+			CheckpointsHeader header = { 0 };
+			header.magic = kCheckpointsMagic;
+			header.version = kCheckpointsVersion;
+			header.file_size = file_size;
+			header.mtime = mtime;
+			header.window = m_window;
+			header.entries = m_checkpoints.size();
+			header.members = m_members_complete ? m_members.size() : 0;
+
+			bool ok = std::fwrite(&header, sizeof(header), 1, fp) == 1;
+			for (const auto& checkpoint: m_checkpoints)
+			{
+				CheckpointEntry entry = { 0 };
+				entry.out_offset = checkpoint.out_offset;
+				entry.in_offset = checkpoint.in_offset;
+				entry.bits = checkpoint.bits;
+				entry.prime = checkpoint.prime;
+				entry.window_size = checkpoint.window.size();
+				ok = ok && std::fwrite(&entry, sizeof(entry), 1, fp) == 1;
+				ok = ok && std::fwrite(checkpoint.window.data(), 1, checkpoint.window.size(), fp) == checkpoint.window.size();
+			}
+			for (uint64_t i = 0; i < header.members; ++i)
+			{
+				ok = ok && std::fwrite(&m_members[i], sizeof(InflateMember), 1, fp) == 1;
+			}
+			ok = (std::fclose(fp) == 0) && ok;
+
+			if (ok)
+			{
+#ifdef _WIN32
+				std::remove(filename.c_str());
+#endif
+				ok = std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+			}
+			if (!ok)
+			{
+				std::remove(tmp_filename.c_str());
+			}
+			return ok;
+		}
+
 	private:
+		static const uint32_t kCheckpointsMagic = 0x495a4244; // "DBZI"
+		static const uint32_t kCheckpointsVersion = 2;
+
+#pragma pack(push,1)
+		struct CheckpointsHeader
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint64_t file_size;
+			uint64_t mtime;
+			int32_t window;
+			uint32_t reserved;
+			uint64_t entries;
+			uint64_t members;
+		};
+
+		struct CheckpointEntry
+		{
+			uint64_t out_offset;
+			uint64_t in_offset;
+			uint8_t bits;
+			uint8_t prime;
+			uint16_t reserved;
+			uint32_t window_size;
+		};
+#pragma pack(pop)
+
+		// Decompresses the next portion of data to `dst`, at most `size` bytes. Returns number of bytes written,
+		// zero at the end of the data.
+		size_t Inflate(uint8_t* dst, size_t size)
+		{
+			while (true)
+			{
+				if (m_parallel_threads > 0 && m_members_complete && m_members.size() > 2)
+				{
+					if (m_batch_begin == m_batch_end && AtMemberStart())
+					{
+						if (m_member_start + 1 == m_members.size())
+							return 0;
+
+						// Members that are larger than the run are inflated by the streaming path
+						const InflateMember& next = m_members[m_member_start + 1];
+						if (next.out_offset - m_members[m_member_start].out_offset <= m_batch_limit)
+							InflateMembers();
+					}
+					if (m_batch_begin < m_batch_end)
+					{
+						size_t will_copy = std::min(m_batch_end - m_batch_begin, size);
+						memcpy(dst, m_batch.get() + m_batch_begin, will_copy);
+						m_batch_begin += will_copy;
+						m_inflated += will_copy;
+						return will_copy;
+					}
+				}
+
+				if (m_inputbuff_end + buff_size >= buff_real_size)
+				{
+					// One consumed byte is kept, it may hold the bits needed for a checkpoint
+					size_t keep = m_inputbuff_begin > 0 ? 1 : 0;
+					memmove(m_input_buff.get(), m_input_buff.get() + m_inputbuff_begin - keep,
+					       m_inputbuff_end - m_inputbuff_begin + keep);
+					m_inputbuff_end -= m_inputbuff_begin - keep;
+					m_inputbuff_begin = keep;
+				}
+				if (m_inputbuff_end - m_inputbuff_begin < buff_size && m_src_offset < m_src_size)
+				{
+					size_t bytes_to_read = std::min(m_src_size - m_src_offset, size_t(buff_size));
+					size_t _bytesRead = 0;
+					m_file->ReadData(m_input_buff.get() + m_inputbuff_end, bytes_to_read, &_bytesRead);
+					m_inputbuff_end += _bytesRead;
+					m_src_offset += _bytesRead;
+					if (_bytesRead == 0)
+						m_src_size = m_src_offset;
+				}
+				if (m_skip_input > 0)
+				{
+					size_t skip = std::min(m_skip_input, m_inputbuff_end - m_inputbuff_begin);
+					m_inputbuff_begin += skip;
+					m_skip_input -= skip;
+				}
+
+				if (m_inputbuff_end == m_inputbuff_begin && m_src_offset == m_src_size)
+				{
+					m_checkpoints_complete = true;
+					m_members_complete = m_members_complete || m_members.back().in_offset == m_src_size;
+					return 0;
+				}
+
+				size_t input_begin = m_inputbuff_begin;
+
+				m_stream.next_in = m_input_buff.get() + m_inputbuff_begin;
+				m_stream.next_out = dst;
+				m_stream.avail_in = m_inputbuff_end - m_inputbuff_begin;
+				m_stream.avail_out = size;
+
+				int result = inflate(&m_stream, m_checkpoint_interval > 0 ? Z_BLOCK : Z_NO_FLUSH);
+				if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+				{
+					throw runtime_error("Inflate failed: %s", m_stream.msg);
+				}
+				size_t inflated = m_stream.next_out - dst;
+				m_inflated += inflated;
+				m_inputbuff_begin = m_stream.next_in - m_input_buff.get();
+
+				if (result == Z_STREAM_END)
+				{
+					// Another stream may follow, e.g. next member of a multi-member gzip file. Raw deflate that was
+					// resumed from a checkpoint does not consume the trailer, it is skipped.
+					if (m_raw)
+					{
+						m_skip_input = m_window > 15 ? 8 : (m_window > 0 ? 4 : 0);
+						m_raw = false;
+					}
+					inflateReset2(&m_stream, m_window);
+					AddMember();
+				}
+				else if (m_checkpoint_interval > 0 && (m_stream.data_type & 128) && !(m_stream.data_type & 64))
+				{
+					AddCheckpoint();
+				}
+
+				if (inflated > 0)
+					return inflated;
+
+				if (m_inputbuff_begin == input_begin && result != Z_STREAM_END && m_src_offset == m_src_size)
+				{
+					// Truncated stream
+					return 0;
+				}
+			}
+		}
+
+		// Called at a deflate block boundary
+		void AddCheckpoint()
+		{
+			uint64_t out_offset = m_inflated;
+			uint64_t last = m_checkpoints.empty() ? 0 : m_checkpoints.back().out_offset;
+			if (out_offset < last + m_checkpoint_interval)
+				return;
+
+			InflateCheckpoint checkpoint;
+			checkpoint.out_offset = out_offset;
+			checkpoint.in_offset = m_src_offset - (m_inputbuff_end - m_inputbuff_begin);
+			checkpoint.bits = m_stream.data_type & 7;
+			checkpoint.prime = 0;
+			if (checkpoint.bits > 0)
+			{
+				if (m_inputbuff_begin == 0)
+					return;
+				checkpoint.prime = m_input_buff.get()[m_inputbuff_begin - 1] >> (8 - checkpoint.bits);
+			}
+
+			uInt window_size = 32768;
+			checkpoint.window.resize(window_size);
+			if (inflateGetDictionary(&m_stream, checkpoint.window.data(), &window_size) != Z_OK)
+				return;
+			checkpoint.window.resize(window_size);
+
+			m_checkpoints.push_back(std::move(checkpoint));
+		}
+
+		// Called at the end of a member
+		void AddMember()
+		{
+			InflateMember member;
+			member.out_offset = m_inflated;
+			member.in_offset = m_src_offset - (m_inputbuff_end - m_inputbuff_begin) + m_skip_input;
+
+			// Boundaries are only recorded one after another, while inflating from a known start of a member
+			const InflateMember& last = m_members.back();
+			if (!m_members_complete && m_member_start + 1 == m_members.size() && member.in_offset > last.in_offset)
+			{
+				m_members.push_back(member);
+			}
+			m_member_start = FindMember(member.out_offset, member.in_offset);
+			m_batch_limit = std::min(m_batch_limit * 2, size_t(parallel_batch_max));
+		}
+
+		// Index of the member that starts at given offsets, or npos
+		size_t FindMember(uint64_t out_offset, uint64_t in_offset) const
+		{
+			auto it = std::lower_bound(m_members.begin(), m_members.end(), in_offset,
+			                           [](const InflateMember& m, uint64_t value) { return m.in_offset < value; });
+			if (it == m_members.end() || it->in_offset != in_offset || it->out_offset != out_offset)
+				return npos;
+			return it - m_members.begin();
+		}
+
+		// True if inflate stands at the start of a member, that is, at `m_member_start`
+		bool AtMemberStart() const
+		{
+			return m_member_start != npos && m_members[m_member_start].out_offset == m_inflated;
+		}
+
+		// Inflates run of whole members that starts at `m_member_start` to the batch buffer, concurrently.
+		// Afterwards, inflate stands at the start of the next member.
+		void InflateMembers()
+		{
+			size_t first = m_member_start;
+			size_t last = first + 1;
+			while (last + 1 < m_members.size() && m_members[last + 1].out_offset - m_members[first].out_offset <= m_batch_limit)
+			{
+				++last;
+			}
+			m_batch_limit = std::min(m_batch_limit * 2, size_t(parallel_batch_max));
+			const InflateMember& begin = m_members[first];
+			const InflateMember& end = m_members[last];
+
+			std::vector<uint8_t> compressed(end.in_offset - begin.in_offset);
+			size_t _bytesRead = 0;
+			m_file->SetPosition(begin.in_offset);
+			m_file->ReadData(compressed.data(), compressed.size(), &_bytesRead);
+			if (_bytesRead != compressed.size())
+				throw runtime_error("Unexpected end of compressed file. File: %s", GetPath().string().c_str());
+
+			size_t batch_size = end.out_offset - begin.out_offset;
+			if (batch_size > m_batch_capacity)
+			{
+				m_batch.reset(new uint8_t[batch_size], std::default_delete<uint8_t[]>());
+				m_batch_capacity = batch_size;
+			}
+
+			std::string error;
+			std::mutex error_mutex;
+
+			#pragma omp parallel for schedule(dynamic) num_threads(m_parallel_threads)
+			for (int i = int(first); i < int(last); ++i)
+			{
+				const InflateMember& member = m_members[i];
+				const InflateMember& next = m_members[i + 1];
+
+				z_stream stream = {nullptr};
+				if (inflateInit2(&stream, m_window) != Z_OK)
+				{
+					std::lock_guard<std::mutex> lock(error_mutex);
+					error = "Failed to init zlib";
+					continue;
+				}
+				stream.next_in = compressed.data() + (member.in_offset - begin.in_offset);
+				stream.avail_in = next.in_offset - member.in_offset;
+				stream.next_out = m_batch.get() + (member.out_offset - begin.out_offset);
+				stream.avail_out = next.out_offset - member.out_offset;
+
+				// Member must decode to exactly the recorded size, trailing bytes would be another member
+				int result = inflate(&stream, Z_FINISH);
+				if (result != Z_STREAM_END || stream.avail_out != 0 || stream.avail_in != 0)
+				{
+					std::lock_guard<std::mutex> lock(error_mutex);
+					if (error.empty())
+						error = string_format("Inflate failed: %s", stream.msg != nullptr ? stream.msg : "member size mismatch");
+				}
+				inflateEnd(&stream);
+			}
+			if (!error.empty())
+				throw runtime_error("%s. File: %s", error.c_str(), GetPath().string().c_str());
+
+			// Streaming inflate continues from the start of the next member
+			if (inflateReset2(&m_stream, m_window) != Z_OK)
+				throw runtime_error("Failed to init zlib");
+			m_raw = false;
+			ResetInput(end.in_offset);
+			m_member_start = last;
+			m_batch_begin = 0;
+			m_batch_end = batch_size;
+		}
+
+		// Last checkpoint at or before `position`
+		const InflateCheckpoint* FindCheckpoint(size_t position) const
+		{
+			auto it = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), uint64_t(position),
+			                           [](uint64_t value, const InflateCheckpoint& c) { return value < c.out_offset; });
+			if (it == m_checkpoints.begin())
+				return nullptr;
+			return &*(it - 1);
+		}
+
+		void ResetInput(uint64_t src_offset)
+		{
+			m_inputbuff_begin = 0;
+			m_inputbuff_end = 0;
+			m_skip_input = 0;
+			m_src_offset = src_offset;
+			m_file->SetPosition(src_offset);
+		}
+
+		void ResetBuffers(uint64_t src_offset, uint64_t dst_offset)
+		{
+			m_outputbuff_begin = 0;
+			m_outputbuff_end = 0;
+			m_batch_begin = 0;
+			m_batch_end = 0;
+			m_batch_limit = parallel_batch_min;
+			m_dst_offset = dst_offset;
+			m_inflated = dst_offset;
+			ResetInput(src_offset);
+		}
+
+		void Restart()
+		{
+			if (inflateReset2(&m_stream, m_window) != Z_OK)
+				throw runtime_error("Failed to init zlib");
+			m_raw = false;
+			m_member_start = 0;
+			ResetBuffers(0, 0);
+		}
+
+		void Restore(const InflateCheckpoint& checkpoint)
+		{
+			if (inflateReset2(&m_stream, -MAX_WBITS) != Z_OK)
+				throw runtime_error("Failed to init zlib");
+			if (checkpoint.bits > 0)
+				inflatePrime(&m_stream, checkpoint.bits, checkpoint.prime);
+			if (!checkpoint.window.empty())
+				inflateSetDictionary(&m_stream, checkpoint.window.data(), checkpoint.window.size());
+			m_raw = true;
+			m_member_start = npos;
+			ResetBuffers(checkpoint.in_offset, checkpoint.out_offset);
+		}
+
 		std::shared_ptr<FileInterface> m_file;
 		size_t m_src_size;
 		size_t m_src_offset;
 		size_t m_dst_offset;
+		uint64_t m_inflated = 0; // uncompressed offset of the end of inflated data
 		z_stream m_stream = {nullptr};
 		int m_window = MAX_WBITS;
+		bool m_raw = false;
+		size_t m_skip_input = 0;
 
 		std::shared_ptr<uint8_t> m_input_buff;
 		std::shared_ptr<uint8_t> m_output_buff;
@@ -192,5 +668,22 @@ namespace fsal
 		size_t m_inputbuff_end;
 		size_t m_outputbuff_begin;
 		size_t m_outputbuff_end;
+
+		size_t m_checkpoint_interval = DefaultCheckpointInterval;
+		bool m_checkpoints_complete = false;
+		std::vector<InflateCheckpoint> m_checkpoints;
+
+		static const size_t npos = size_t(-1);
+		int m_parallel_threads = 0;
+		bool m_members_complete = false;
+		std::vector<InflateMember> m_members;
+		size_t m_member_start = 0; // member that inflate stands at or inside of, npos if unknown
+
+		// Members inflated in parallel, [m_batch_begin, m_batch_end) is not consumed yet
+		std::shared_ptr<uint8_t> m_batch;
+		size_t m_batch_capacity = 0;
+		size_t m_batch_limit = parallel_batch_min;
+		size_t m_batch_begin = 0;
+		size_t m_batch_end = 0;
 	};
 }
@@ -4,9 +4,41 @@ import PIL.Image
 import zipfile
 import numpy as np
 import pickle
+import struct
+import os
 import dareblopy as db
 
 
+def small_filenames(compressed=False):
+    """Filenames of the four small test tfrecord files"""
+    return ['test_utils/test-small-%sr%02d.tfrecords' % ('gzip-' if compressed else '', i) for i in range(4)]
+
+
+def load_records_gt(compressed=False, per_file=False):
+    """Ground truth records of the small test files, as one list or, if `per_file` is set, as a list per file"""
+    records_gt = []
+    for i in range(4):
+        with open('test_utils/test-small-records-%sr%02d.pth' % ('gzip-' if compressed else '', i), 'rb') as f:
+            records = pickle.load(f)
+        records_gt += [records] if per_file else records
+    return records_gt
+
+
+def read_batches(record_yielder, n=32):
+    """Yields batches of `n` records until the record yielder is exhausted"""
+    while True:
+        try:
+            batch = record_yielder.next_n(n)
+        except StopIteration:
+            return
+        yield batch
+
+
+def read_all(record_yielder):
+    """Reads all records of the record yielder"""
+    return [record for batch in read_batches(record_yielder) for record in batch]
+
+
 class BasicFileOps(unittest.TestCase):
     def test_file_exist(self):
         fs = db.FileSystem()
@@ -64,6 +96,17 @@ class FileAndImageReadingOps(unittest.TestCase):
         b2 = db.open_as_bytes("test_utils/test_image.jpg")
         self.assertEqual(b1, b2)
 
+    def test_reading_to_bytes_direct(self):
+        f = open("test_utils/test_image.jpg", 'rb')
+        b1 = f.read()
+        f.close()
+
+        b2 = db.open_as_bytes("test_utils/test_image.jpg", direct=True)
+        self.assertEqual(b1, b2)
+
+        ndarray = db.open_as_numpy_ubyte("test_utils/test_image.jpg", direct=True)
+        self.assertEqual(b1, ndarray.tobytes())
+
     def test_reading_to_bytes_does_not_exist(self):
         with self.assertRaises(RuntimeError) as context:
             db.open_as_bytes("does_not_exist")
@@ -151,32 +194,519 @@ class TFRecordsReading(unittest.TestCase):
 
         self.assertEqual(records_gt, records)
 
-    def test_record_yielder(self):
-        record_yielder = db.RecordYielderBasic(['test_utils/test-small-r00.tfrecords',
-                                                'test_utils/test-small-r01.tfrecords',
-                                                'test_utils/test-small-r02.tfrecords',
-                                                'test_utils/test-small-r03.tfrecords'])
+    def test_reading_record_mmap(self):
+        rr = db.RecordReader('test_utils/test-small-r00.tfrecords', mode=db.ReadMode.MMAP)
+        self.assertIsNotNone(rr)
 
-        self.assertIsNotNone(record_yielder)
-        records = []
+        records = list(rr)
+        self.assertEqual(len(records), 50)
+        self.assertFalse(records[0].flags.writeable)
+
+        with open('test_utils/test-small-records-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        self.assertEqual(records_gt, [x.tobytes() for x in records])
+
+    def test_reading_record_buffered(self):
+        with open('test_utils/test-small-records-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        # block sizes that are not multiple of record size, so that records straddle blocks
+        for block_size in [64, 1000, 4096, 1024 * 1024]:
+            rr = db.RecordReader('test_utils/test-small-r00.tfrecords', mode=db.ReadMode.BUFFERED, block_size=block_size)
+            self.assertEqual(records_gt, list(rr))
+
+        rr = db.RecordReader('test_utils/test-small-gzip-r00.tfrecords', db.Compression.ZLIB, db.ReadMode.BUFFERED, 1000)
+        with open('test_utils/test-small-records-gzip-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+        self.assertEqual(records_gt, list(rr))
+
+    def test_reading_record_async(self):
+        with open('test_utils/test-small-records-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        rr = db.RecordReader('test_utils/test-small-r00.tfrecords', mode=db.ReadMode.ASYNC, block_size=4096, io_depth=4)
+        self.assertEqual(records_gt, list(rr))
+        self.assertEqual(records_gt[3], rr.read_record(3 * (len(records_gt[0]) + 16)))
+
+        with self.assertRaises(RuntimeError):
+            db.RecordReader('test_utils/test-small-r00.tfrecords', mode=db.ReadMode.ASYNC, block_size=0)
+
+    def test_reading_record_direct(self):
+        with open('test_utils/test-small-records-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        for block_size in [64, 1000, 4096, 1024 * 1024]:
+            rr = db.RecordReader('test_utils/test-small-r00.tfrecords', mode=db.ReadMode.DIRECT, block_size=block_size)
+            self.assertEqual(records_gt, list(rr))
+            self.assertEqual(records_gt[3], rr.read_record(3 * (len(records_gt[0]) + 16)))
+
+    def test_reading_records_batched(self):
+        with open('test_utils/test-small-records-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        record_size = len(records_gt[0]) + 16
+        numbers = np.array([7, 3, 3, 49, 0, 12, 11, 10])
+        for mode in [db.ReadMode.STREAM, db.ReadMode.BUFFERED, db.ReadMode.MMAP]:
+            rr = db.RecordReader('test_utils/test-small-r00.tfrecords', mode=mode)
+            records = rr.read_records(numbers * record_size)
+            if mode == db.ReadMode.MMAP:
+                records = [x.tobytes() for x in records]
+            self.assertEqual([records_gt[i] for i in numbers], records)
+
+    def test_reading_record_advise(self):
+        with open('test_utils/test-small-records-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        for mode in [db.ReadMode.STREAM, db.ReadMode.BUFFERED, db.ReadMode.ASYNC]:
+            rr = db.RecordReader('test_utils/test-small-r00.tfrecords', mode=mode, advise=True)
+            self.assertEqual(records_gt, list(rr))
 
-        while True:
-            try:
-                batch = record_yielder.next_n(32)
-                records += batch
-            except StopIteration:
-                break
+        rr = db.RecordReader('test_utils/test-small-r00.tfrecords', mode=db.ReadMode.MMAP, advise=True)
+        self.assertEqual(records_gt, [x.tobytes() for x in rr])
+
+        with open('test_utils/test-small-records-gzip-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        rr = db.RecordReader('test_utils/test-small-gzip-r00.tfrecords', db.Compression.ZLIB, advise=True)
+        self.assertEqual(records_gt, list(rr))
+
+    def test_reading_record_libdeflate(self):
+        for i in range(4):
+            with open('test_utils/test-small-records-gzip-r%02d.pth' % i, 'rb') as f:
+                records_gt = pickle.load(f)
+
+            rr = db.RecordReader('test_utils/test-small-gzip-r%02d.tfrecords' % i, db.Compression.ZLIB,
+                                 inflate_backend=db.InflateBackend.LIBDEFLATE)
+            self.assertEqual(records_gt, list(rr))
+
+    def test_reading_record_background_inflate(self):
+        with open('test_utils/test-small-records-gzip-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        rr = db.RecordReader('test_utils/test-small-gzip-r00.tfrecords', db.Compression.ZLIB)
+        rr.start_background_inflate(block_size=4096, depth=2)
+        self.assertEqual(records_gt, list(rr))
+
+        record_yielder = db.RecordYielderBasic(small_filenames(compressed=True), db.Compression.ZLIB,
+                                               background_inflate=True)
+        self.assertEqual(load_records_gt(compressed=True), list(record_yielder))
+
+    def test_writing_record(self):
+        with open('test_utils/test-small-records-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        for compression in [db.Compression.NONE, db.Compression.GZIP, db.Compression.ZLIB, db.Compression.LZ4]:
+            with db.RecordWriter('test_utils/test-written.tfrecords', compression) as writer:
+                for record in records_gt:
+                    writer.write(record)
+
+            rr = db.RecordReader('test_utils/test-written.tfrecords', compression)
+            self.assertEqual(records_gt, list(rr))
+
+            rr = db.RecordReader('test_utils/test-written.tfrecords', compression)
+            self.assertEqual(rr.get_metadata()[2], len(records_gt))
+        os.remove('test_utils/test-written.tfrecords')
+
+    def test_writing_record_compressed_payloads(self):
+        with open('test_utils/test-small-records-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        for record_compression in [db.RecordCompression.LZ4, db.RecordCompression.DEFLATE]:
+            with db.RecordWriter('test_utils/test-written.tfrecords', record_compression=record_compression) as writer:
+                for record in records_gt:
+                    writer.write(record)
+
+            for mode in [db.ReadMode.STREAM, db.ReadMode.BUFFERED]:
+                rr = db.RecordReader('test_utils/test-written.tfrecords', mode=mode)
+                self.assertEqual(records_gt, list(rr))
+
+                dataset = db.RecordDataset(['test_utils/test-written.tfrecords'], mode=mode, save_index=False)
+                numbers = np.random.RandomState(0).permutation(len(dataset))[:40]
+                self.assertEqual([records_gt[i] for i in numbers], dataset.read_records(numbers))
+
+            # Corrupted uncompressed size is rejected before it is allocated, even if crc32 is not checked
+            with open('test_utils/test-written.tfrecords', 'r+b') as f:
+                f.seek(12)
+                f.write(struct.pack('<Q', 2 ** 40))
+            rr = db.RecordReader('test_utils/test-written.tfrecords')
+            rr.set_verification(db.Verification.NONE)
+            with self.assertRaises(RuntimeError):
+                next(rr)
+        os.remove('test_utils/test-written.tfrecords')
+
+    def test_reading_record_verification(self):
+        with open('test_utils/test-small-records-r00.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        for verification in [db.Verification.FULL, db.Verification.HEADER_ONLY, db.Verification.SAMPLED, db.Verification.NONE]:
+            rr = db.RecordReader('test_utils/test-small-r00.tfrecords')
+            rr.set_verification(verification, 7)
+            self.assertEqual(records_gt, list(rr))
+
+    def test_reading_record_verification_large(self):
+        # Payloads of 4MiB and more are checked in chunks in parallel, and the crc32 of chunks are combined
+        records_gt = [b'head', np.random.RandomState(0).bytes(5 * 1024 * 1024 + 123), b'tail']
+        with db.RecordWriter('test_utils/test-written.tfrecords') as writer:
+            for record in records_gt:
+                writer.write(record)
+
+        for mode in [db.ReadMode.STREAM, db.ReadMode.MMAP]:
+            rr = db.RecordReader('test_utils/test-written.tfrecords', mode=mode)
+            rr.set_verification(db.Verification.FULL)
+            records = list(rr)
+            if mode == db.ReadMode.MMAP:
+                records = [x.tobytes() for x in records]
+            self.assertEqual(records_gt, records)
+
+        # One corrupted byte in the middle of the large payload
+        with open('test_utils/test-written.tfrecords', 'r+b') as f:
+            f.seek(12 + len(records_gt[0]) + 4 + 12 + 3 * 1024 * 1024)
+            byte = f.read(1)
+            f.seek(-1, os.SEEK_CUR)
+            f.write(bytes([byte[0] ^ 0x10]))
+
+        for mode in [db.ReadMode.STREAM, db.ReadMode.MMAP]:
+            rr = db.RecordReader('test_utils/test-written.tfrecords', mode=mode)
+            rr.set_verification(db.Verification.FULL)
+            next(rr)
+            with self.assertRaises(RuntimeError):
+                next(rr)
+        os.remove('test_utils/test-written.tfrecords')
+
+    def test_reading_record_by_number(self):
+        index_file = 'test_utils/test-small-r01.tfrecords.index'
+        if os.path.exists(index_file):
+            os.remove(index_file)
+
+        rr = db.RecordReader('test_utils/test-small-r01.tfrecords')
+        self.assertTrue(rr.load_index())
+        self.assertTrue(os.path.exists(index_file))
+
+        rr = db.RecordReader('test_utils/test-small-r01.tfrecords')
+        self.assertTrue(rr.load_index(build=False))
+        self.assertEqual(len(rr), 50)
+        self.assertEqual(rr.get_metadata()[2], 50)
+
+        with open('test_utils/test-small-records-r01.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        self.assertEqual(records_gt[17], rr[17])
+        self.assertEqual(records_gt[-1], rr[-1])
+        self.assertEqual(records_gt, [rr[i] for i in range(len(rr))])
+
+        with self.assertRaises(IndexError):
+            rr[50]
+
+        os.remove(index_file)
+
+    def test_reading_compressed_record_by_number(self):
+        filename = 'test_utils/test-small-gzip-r01.tfrecords'
+        sidecars = [filename + '.index', filename + '.zindex']
+
+        rr = db.RecordReader(filename, db.Compression.ZLIB)
+        self.assertTrue(rr.load_index())
+        for sidecar in sidecars:
+            self.assertTrue(os.path.exists(sidecar))
+
+        with open('test_utils/test-small-records-gzip-r01.pth', 'rb') as f:
+            records_gt = pickle.load(f)
+
+        rr = db.RecordReader(filename, db.Compression.ZLIB)
+        self.assertTrue(rr.load_index(build=False))
+        numbers = np.random.RandomState(0).permutation(len(rr))
+        self.assertEqual([records_gt[i] for i in numbers], [rr[i] for i in numbers])
+
+        for sidecar in sidecars:
+            os.remove(sidecar)
+
+    def test_reading_record_parallel_inflate(self):
+        filename = 'test_utils/test-multi-member.tfrecords'
+        records_gt = load_records_gt(compressed=True)
+        with open(filename, 'wb') as f_out:
+            for member in small_filenames(compressed=True):
+                with open(member, 'rb') as f:
+                    f_out.write(f.read())
+
+        rr = db.RecordReader(filename, db.Compression.ZLIB)
+        self.assertTrue(rr.load_index())
+
+        rr = db.RecordReader(filename, db.Compression.ZLIB)
+        self.assertTrue(rr.load_index(build=False))
+        rr.set_parallel_inflate(4)
+        self.assertEqual(records_gt, list(rr))
+        numbers = np.random.RandomState(0).permutation(len(rr))[:50]
+        self.assertEqual([records_gt[i] for i in numbers], [rr[i] for i in numbers])
+
+        for f in [filename, filename + '.index', filename + '.zindex']:
+            os.remove(f)
+
+    def test_record_dataset(self):
+        records_gt = load_records_gt()
+        dataset = db.RecordDataset(small_filenames(), max_open_files=2, save_index=False)
+        self.assertEqual(len(dataset), 200)
+
+        numbers = np.random.RandomState(0).permutation(len(dataset))
+        self.assertEqual([records_gt[i] for i in numbers], [dataset[i] for i in numbers])
+        self.assertEqual(records_gt[-1], dataset[-1])
+        self.assertEqual([records_gt[i] for i in numbers[:40]], dataset.read_records(numbers[:40]))
+
+        with self.assertRaises(IndexError):
+            dataset[200]
+
+    def test_record_dataset_gzip(self):
+        records_gt = load_records_gt(compressed=True)
+        filenames = small_filenames(compressed=True)
+        numbers = np.random.RandomState(0).permutation(len(records_gt))
+        for save_index in [False, True]:
+            dataset = db.RecordDataset(filenames, db.Compression.ZLIB, max_open_files=2, save_index=save_index)
+            self.assertEqual(len(dataset), len(records_gt))
+            self.assertEqual([records_gt[i] for i in numbers], [dataset[i] for i in numbers])
+            self.assertEqual([records_gt[i] for i in numbers[:40]], dataset.read_records(numbers[:40]))
+
+        for filename in filenames:
+            for f in [filename + '.index', filename + '.zindex']:
+                if os.path.exists(f):
+                    os.remove(f)
+
+    def test_get_metadata_many(self):
+        filenames = small_filenames()
+        file_size, data_size, entries = db.get_metadata_many(filenames, threads=2)
+        for i, filename in enumerate(filenames):
+            self.assertEqual((file_size[i], data_size[i], entries[i]), db.RecordReader(filename).get_metadata())
+
+        with self.assertRaises(RuntimeError):
+            db.get_metadata_many(filenames + ['does_not_exist.tfrecords'])
+
+    def test_record_yielder(self):
+        record_yielder = db.RecordYielderBasic(small_filenames())
+        self.assertIsNotNone(record_yielder)
 
         # reading ground truth records to confirm reading the container was correct
-        records_gt = []
-        for file in ['test_utils/test-small-records-r00.pth',
-                     'test_utils/test-small-records-r01.pth',
-                     'test_utils/test-small-records-r02.pth',
-                     'test_utils/test-small-records-r03.pth']:
-            with open(file, 'rb') as f:
-                records_gt += pickle.load(f)
+        self.assertEqual(load_records_gt(), read_all(record_yielder))
+
+    def test_record_yielder_async(self):
+        record_yielder = db.RecordYielderBasic(small_filenames(), io_depth=4)
+        self.assertEqual(load_records_gt(), read_all(record_yielder))
+
+    def test_record_yielder_prefetch(self):
+        filenames = small_filenames()
+        records = read_all(db.RecordYielderBasic(filenames, prefetch_depth=4, reader_threads=2))
+        self.assertEqual(load_records_gt(), records)
+
+        # Prefetching must not change the shuffle order
+        records = read_all(db.RecordYielderRandomized(filenames, buffer_size=16, seed=0, epoch=0,
+                                                      prefetch_depth=4, reader_threads=2))
+        records_sync = read_all(db.RecordYielderRandomized(filenames, buffer_size=16, seed=0, epoch=0))
+        self.assertEqual(records_sync, records)
+
+        with self.assertRaises(RuntimeError):
+            read_all(db.RecordYielderBasic(['does_not_exist-r00.tfrecords'], prefetch_depth=4))
+
+    def test_record_yielder_interleave(self):
+        records_gt = load_records_gt(per_file=True)
+
+        # With a buffer of one record the yielded order is the interleaved order
+        records = read_all(db.RecordYielderRandomized(small_filenames(), buffer_size=1, seed=0, epoch=0,
+                                                      cycle_length=2, block_length=3))
+
+        def file_of(record):
+            return [i for i, file_records in enumerate(records_gt) if record in file_records][0]
+
+        self.assertEqual(sum(len(x) for x in records_gt), len(records))
+        first, second = file_of(records[0]), file_of(records[3])
+        self.assertNotEqual(first, second)
+        self.assertEqual([first] * 3 + [second] * 3 + [first] * 3, [file_of(r) for r in records[:9]])
+        for file_records in records_gt:
+            self.assertEqual(file_records, [r for r in records if r in file_records])
+
+    def test_record_yielder_sharding(self):
+        filenames = small_filenames()
+        records_gt = load_records_gt(per_file=True)
+
+        records = read_all(db.RecordYielderBasic(filenames, shard_index=1, num_shards=2))
+        self.assertEqual(records_gt[1] + records_gt[3], records)
+
+        # Records are numbered across files
+        records = read_all(db.RecordYielderBasic(filenames, shard_index=1, num_shards=3, sharding=db.Sharding.RECORD))
+        self.assertEqual([r for x in records_gt for r in x][1::3], records)
+
+        # Shards differ by at most one record, whatever the sizes of the files, so that data-parallel workers run the
+        # same number of steps
+        for num_shards in [3, 8, 60]:
+            for prefetch_depth in [0, 4]:
+                lengths = [len(read_all(db.RecordYielderBasic(filenames, shard_index=i, num_shards=num_shards,
+                                                              sharding=db.Sharding.RECORD, prefetch_depth=prefetch_depth)))
+                           for i in range(num_shards)]
+                self.assertEqual(200, sum(lengths))
+                self.assertLessEqual(max(lengths) - min(lengths), 1)
+
+                lengths = [len(read_all(db.RecordYielderRandomized(filenames, buffer_size=16, seed=0, epoch=1,
+                                                                   prefetch_depth=prefetch_depth, shard_index=i,
+                                                                   num_shards=num_shards, sharding=db.Sharding.RECORD)))
+                           for i in range(num_shards)]
+                self.assertEqual(200, sum(lengths))
+                self.assertLessEqual(max(lengths) - min(lengths), 1)
+
+        # Shards of the same seed and epoch are disjoint and cover all records
+        for sharding in [db.Sharding.FILE, db.Sharding.RECORD]:
+            shards = [read_all(db.RecordYielderRandomized(filenames, buffer_size=16, seed=0, epoch=1,
+                                                          shard_index=i, num_shards=2, sharding=sharding))
+                      for i in range(2)]
+            self.assertEqual(sorted(r for x in records_gt for r in x), sorted(shards[0] + shards[1]))
+
+        with self.assertRaises(RuntimeError):
+            db.RecordYielderBasic(filenames, shard_index=2, num_shards=2)
+
+    def test_record_yielder_randomized_state(self):
+        filenames = small_filenames()
+        record_yielder = db.RecordYielderRandomized(filenames, buffer_size=16, seed=0, epoch=3)
+        record_yielder.next_n(70)
+        states = [pickle.loads(pickle.dumps(record_yielder.get_state())),
+                  pickle.loads(pickle.dumps(record_yielder.get_state(include_buffer=True)))]
+        records = read_all(record_yielder)
+
+        # Resumed yielders continue with the same records
+        for state in states:
+            resumed = db.RecordYielderRandomized(filenames, buffer_size=16, seed=0, epoch=3)
+            resumed.set_state(state)
+            self.assertEqual(records, read_all(resumed))
+
+    def test_parsed_record_yielder_randomized(self):
+        filenames = small_filenames()
+        parser = db.RecordParser({'data': db.FixedLenFeature([3, 32, 32], db.uint8)})
+
+        def read_images(record_yielder):
+            return np.concatenate([batch[0] for batch in read_batches(record_yielder, 8)])
+
+        # Records and their order are the same as of RecordYielderRandomized, which keeps records as bytes objects
+        records = read_all(db.RecordYielderRandomized(filenames, buffer_size=32, seed=0, epoch=0))
+        images_gt = parser.parse_example(records)[0]
+        self.assertEqual(200, len(images_gt))
+
+        # Small slabs make the arena compact several times in the epoch
+        for slab_size in [16 * 1024, 16 * 1024 * 1024]:
+            images = read_images(db.ParsedRecordYielderRandomized(parser, filenames, buffer_size=32, seed=0, epoch=0,
+                                                                  slab_size=slab_size))
+            self.assertTrue(np.array_equal(images_gt, images))
+
+        # Individually compressed records stay compressed in the buffer
+        compressed = ['test_utils/test-written-r0%d.tfrecords' % i for i in range(4)]
+        for filename, compressed_filename in zip(filenames, compressed):
+            with db.RecordWriter(compressed_filename, record_compression=db.RecordCompression.LZ4) as writer:
+                for record in db.RecordReader(filename):
+                    writer.write(record)
+        images = read_images(db.ParsedRecordYielderRandomized(parser, compressed, buffer_size=32, seed=0, epoch=0,
+                                                              slab_size=16 * 1024))
+        self.assertTrue(np.array_equal(images_gt, images))
+        for filename in compressed:
+            os.remove(filename)
+
+    def test_parsed_record_yielder_randomized_state(self):
+        filenames = small_filenames()
+        parser = db.RecordParser({'data': db.FixedLenFeature([3, 32, 32], db.uint8)})
+
+        def read_images(record_yielder):
+            return np.concatenate([batch[0] for batch in read_batches(record_yielder, 8)])
+
+        for sharding in [db.Sharding.FILE, db.Sharding.RECORD]:
+            def make_yielder():
+                return db.ParsedRecordYielderRandomized(parser, filenames, buffer_size=16, seed=0, epoch=3,
+                                                        shard_index=1, num_shards=3, sharding=sharding)
+            record_yielder = make_yielder()
+            record_yielder.next_n(20)
+            states = [pickle.loads(pickle.dumps(record_yielder.get_state())),
+                      pickle.loads(pickle.dumps(record_yielder.get_state(include_buffer=True)))]
+            images = read_images(record_yielder)
+
+            # Resumed yielders continue with the same records
+            for state in states:
+                resumed = make_yielder()
+                resumed.set_state(state)
+                self.assertTrue(np.array_equal(images, read_images(resumed)))
+
+    def test_record_yielder_randomized_buffer_bytes(self):
+        filenames = small_filenames()
+        records_gt = load_records_gt()
+        buffer_bytes = sum(len(r) for r in records_gt[:8])
+        max_record = max(len(r) for r in records_gt)
+
+        orders = []
+        for prefetch_depth in [0, 4]:
+            record_yielder = db.RecordYielderRandomized(filenames, buffer_size=0, seed=0, epoch=0,
+                                                        prefetch_depth=prefetch_depth, buffer_bytes=buffer_bytes)
+            records = record_yielder.next_n(1)
+            # Buffer holds the limit, give or take one record, and a few dozen bytes of overhead per record
+            self.assertGreaterEqual(record_yielder.resident_bytes(), buffer_bytes - len(records[0]))
+            self.assertLessEqual(record_yielder.resident_bytes(), buffer_bytes + max_record + 16 * 128)
+            records += read_all(record_yielder)
+            self.assertEqual(sorted(records_gt), sorted(records))
+            orders.append(records)
+
+        # Prefetching does not change the order
+        self.assertEqual(orders[0], orders[1])
+
+        # Parsed yielder fills its buffer the same way. With slabs smaller than two records, each record takes a
+        # slab of its own, and two empty slabs are kept for reuse
+        parser = db.RecordParser({'data': db.FixedLenFeature([3, 32, 32], db.uint8)})
+        slab_size = 4096
+        self.assertTrue(max_record < slab_size < 2 * min(len(r) for r in records_gt))
+        record_yielder = db.ParsedRecordYielderRandomized(parser, filenames, buffer_size=0, seed=0, epoch=0,
+                                                          buffer_bytes=buffer_bytes, slab_size=slab_size)
+        batches = [record_yielder.next_n(1)[0]]
+        records_in_buffer = buffer_bytes // max_record + 1
+        self.assertLessEqual(record_yielder.resident_bytes(), (records_in_buffer + 2) * slab_size + 16 * 64)
+        batches += [batch[0] for batch in read_batches(record_yielder)]
+        self.assertTrue(np.array_equal(parser.parse_example(orders[0])[0], np.concatenate(batches)))
+
+        with self.assertRaises(RuntimeError):
+            db.RecordYielderRandomized(filenames, buffer_size=0, seed=0, epoch=0)
+        with self.assertRaises(RuntimeError):
+            db.ParsedRecordYielderRandomized(parser, filenames, buffer_size=0, seed=0, epoch=0)
+
+    def test_record_yielder_mixture(self):
+        filenames = small_filenames()
+        sources = [filenames[:2], filenames[2:]]
+        records_gt = load_records_gt(per_file=True)
+        records_gt = [records_gt[0] + records_gt[1], records_gt[2] + records_gt[3]]
+
+        # Without restarts all records of all sources are yielded once
+        records = read_all(db.RecordYielderMixture(sources, [0.7, 0.3], buffer_size=16, seed=0, epoch=0))
+        self.assertEqual(sorted(records_gt[0] + records_gt[1]), sorted(records))
+
+        # With restarts proportions follow the weights
+        record_yielder = db.RecordYielderMixture(sources, [0.8, 0.2], buffer_size=16, seed=0, epoch=0, restart=True)
+        records = record_yielder.next_n(1000)
+        self.assertEqual(1000, len(records))
+        from_first = sum(1 for r in records if r in records_gt[0])
+        self.assertGreater(from_first, 700)
+        self.assertLess(from_first, 900)
+
+        with self.assertRaises(RuntimeError):
+            db.RecordYielderMixture(sources, [1.0], buffer_size=16, seed=0, epoch=0)
+
+    def test_record_yielder_global_shuffle(self):
+        filenames = small_filenames()
+        records_gt = load_records_gt()
+
+        def read_shuffled(**kwargs):
+            record_yielder = db.RecordYielderGlobalShuffle(filenames, block_size=4, window=3, save_index=False, **kwargs)
+            records = read_all(record_yielder)
+            self.assertEqual(len(record_yielder), len(records))
+            return records
+
+        records = read_shuffled(seed=0, epoch=0)
+        self.assertEqual(sorted(records_gt), sorted(records))
+        self.assertNotEqual(records_gt, records)
+        # Unlike the shuffle buffer, first records come from more than one file
+        self.assertGreater(len({records_gt.index(r) // 50 for r in records[:50]}), 1)
 
-        self.assertEqual(records_gt, records)
+        self.assertEqual(records, read_shuffled(seed=0, epoch=0))
+        self.assertNotEqual(records, read_shuffled(seed=0, epoch=1))
+
+        # Shards split the dataset
+        shards = [read_shuffled(seed=0, epoch=0, shard_index=i, num_shards=3) for i in range(3)]
+        self.assertEqual(sorted(records_gt), sorted(shards[0] + shards[1] + shards[2]))
 
     def test_record_yielder_does_not_exist(self):
         record_yielder = db.RecordYielderBasic(['does_not_exist-r00.tfrecords',
@@ -185,43 +715,21 @@ class TFRecordsReading(unittest.TestCase):
                                                 'does_not_exist-r03.tfrecords'])
 
         self.assertIsNotNone(record_yielder)
-        records = []
 
         with self.assertRaises(RuntimeError) as context:
-            while True:
-                try:
-                    batch = record_yielder.next_n(32)
-                    records += batch
-                except StopIteration:
-                    break
+            read_all(record_yielder)
 
     def test_record_yielder_randomized(self):
-        record_yielder = db.RecordYielderRandomized(['test_utils/test-small-r00.tfrecords',
-                                                     'test_utils/test-small-r01.tfrecords',
-                                                     'test_utils/test-small-r02.tfrecords',
-                                                     'test_utils/test-small-r03.tfrecords'],
+        record_yielder = db.RecordYielderRandomized(small_filenames(),
                                                     buffer_size=16,
                                                     seed=0,
                                                     epoch=0)
 
         self.assertIsNotNone(record_yielder)
-        records = []
-
-        while True:
-            try:
-                batch = record_yielder.next_n(32)
-                records += batch
-            except StopIteration:
-                break
+        records = read_all(record_yielder)
 
         # reading ground truth records to confirm reading the container was correct
-        records_gt = []
-        for file in ['test_utils/test-small-records-r00.pth',
-                     'test_utils/test-small-records-r01.pth',
-                     'test_utils/test-small-records-r02.pth',
-                     'test_utils/test-small-records-r03.pth']:
-            with open(file, 'rb') as f:
-                records_gt += pickle.load(f)
+        records_gt = load_records_gt()
 
         self.assertNotEqual(records_gt, records)
 
@@ -249,15 +757,9 @@ class TFRecordsReading(unittest.TestCase):
                                                     epoch=0)
 
         self.assertIsNotNone(record_yielder)
-        records = []
 
         with self.assertRaises(RuntimeError) as context:
-            while True:
-                try:
-                    batch = record_yielder.next_n(32)
-                    records += batch
-                except StopIteration:
-                    break
+            read_all(record_yielder)
 
 
 class TFRecordsReadingCompressed(unittest.TestCase):
@@ -279,43 +781,18 @@ class TFRecordsReadingCompressed(unittest.TestCase):
         self.assertEqual(records_gt, records)
 
     def test_record_yielder(self):
-        record_yielder = db.RecordYielderBasic(['test_utils/test-small-gzip-r00.tfrecords',
-                                                'test_utils/test-small-gzip-r01.tfrecords',
-                                                'test_utils/test-small-gzip-r02.tfrecords',
-                                                'test_utils/test-small-gzip-r03.tfrecords'], db.Compression.ZLIB)
-
+        record_yielder = db.RecordYielderBasic(small_filenames(compressed=True), db.Compression.ZLIB)
         self.assertIsNotNone(record_yielder)
-        records = []
-
-        while True:
-            try:
-                batch = record_yielder.next_n(32)
-                records += batch
-            except StopIteration:
-                break
 
         # reading ground truth records to confirm reading the container was correct
-        records_gt = []
-        for file in ['test_utils/test-small-records-gzip-r00.pth',
-                     'test_utils/test-small-records-gzip-r01.pth',
-                     'test_utils/test-small-records-gzip-r02.pth',
-                     'test_utils/test-small-records-gzip-r03.pth']:
-            with open(file, 'rb') as f:
-                records_gt += pickle.load(f)
+        self.assertEqual(load_records_gt(compressed=True), read_all(record_yielder))
 
-        self.assertEqual(records_gt, records)
 
 
 class TFRecordsParsing(unittest.TestCase):
     def setUp(self):
         # reading records
-        self.records = []
-        for file in ['test_utils/test-small-records-r00.pth',
-                     'test_utils/test-small-records-r01.pth',
-                     'test_utils/test-small-records-r02.pth',
-                     'test_utils/test-small-records-r03.pth']:
-            with open(file, 'rb') as f:
-                self.records += pickle.load(f)
+        self.records = load_records_gt()
 
         # reading ground-truth data
         self.images_gt = []